@@ -0,0 +1,129 @@
+// Compares CollisionMap with the std::unordered_map (and 'pos_hash') the turtle used before, replaying the
+// collision bookkeeping of real trees read from segment OBJ files (as written by 'Forest::saveFittest').
+//
+// Usage: collision_map_bench [repetitions] [segments.obj...]
+//
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <cmath>
+#include "../src/pos.h"
+#include "../src/collision_map.h"
+
+static constexpr unsigned int collision_precision = 1000;
+
+static std::vector<std::pair<CollisionPos, CollisionPos>> readSegments(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Could not open '" + path + "'");
+
+    std::vector<CollisionPos> vertices;
+    std::vector<std::pair<CollisionPos, CollisionPos>> segments;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream ss(line.substr(std::min<size_t>(2, line.size())));
+        if (line.rfind("v ", 0) == 0) {
+            double x, y, z;
+            ss >> x >> y >> z;
+            vertices.push_back({
+                (int) std::lround(x * collision_precision),
+                (int) std::lround(y * collision_precision),
+                (int) std::lround(z * collision_precision)
+            });
+        } else if (line.rfind("l ", 0) == 0) {
+            // Consecutive segments share vertices, so they refer to them by index (OBJ indices start at 1)
+            size_t from, to;
+            ss >> from >> to;
+            if (!ss || from == 0 || to == 0 || from > vertices.size() || to > vertices.size())
+                throw std::runtime_error("Invalid line '" + line + "' in '" + path + "'");
+            segments.emplace_back(vertices[from - 1], vertices[to - 1]);
+        }
+    }
+    return segments;
+}
+
+// Same operations 'Turtle' does for every move, returns the number of seeds
+template<class Map>
+static size_t replayStd(const std::vector<std::pair<CollisionPos, CollisionPos>> &segments, Map &map) {
+    map.clear();
+    map.insert({{}, false});
+    for (size_t i = 0; i < segments.size(); i++) {
+        auto search = map.find(segments[i].first);
+        if (search != map.end())
+            search->second = false;
+        map.insert({segments[i].second, i % 2 == 0});
+    }
+    size_t n_seeds = 0;
+    for (const auto &pos : map)
+        n_seeds += pos.second;
+    return n_seeds;
+}
+
+static size_t replayFlat(const std::vector<std::pair<CollisionPos, CollisionPos>> &segments, CollisionMap &map) {
+    map.clear();
+    map.insert({}, false);
+    for (size_t i = 0; i < segments.size(); i++) {
+        if (auto *is_seed = map.find(segments[i].first))
+            *is_seed = false;
+        map.insert(segments[i].second, i % 2 == 0);
+    }
+    size_t n_seeds = 0;
+    map.forEach([&n_seeds](const CollisionPos &, bool is_seed) { n_seeds += is_seed; });
+    return n_seeds;
+}
+
+struct MixedHash {
+    std::size_t operator()(const CollisionPos &pos) const {
+        return CollisionMap::hash(pos);
+    }
+};
+
+template<class Func>
+static double nsPerMove(size_t n_moves, unsigned int repetitions, Func func) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int r = 0; r < repetitions; r++)
+        func();
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double) (n_moves * repetitions);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int repetitions = argc > 1 ? std::stoi(argv[1]) : 200;
+    std::vector<std::string> paths;
+    for (int i = 2; i < argc; i++)
+        paths.emplace_back(argv[i]);
+    if (paths.empty())
+        paths = {"out_no_skips/fittest_segments.obj", "out_skips/fittest_segments.obj"};
+
+    std::cout << "file,segments,distinct_positions,distinct_pos_hash,unordered_map_pos_hash_ns,"
+                 "unordered_map_mixed_hash_ns,collision_map_ns\n";
+    for (const auto &path : paths) {
+        auto segments = readSegments(path);
+
+        std::unordered_set<std::size_t> pos_hashes;
+        std::unordered_set<CollisionPos, MixedHash> positions;
+        for (const auto &[from, to] : segments) {
+            pos_hashes.insert(pos_hash()(to));
+            positions.insert(to);
+        }
+
+        std::unordered_map<CollisionPos, bool, pos_hash> old_map;
+        std::unordered_map<CollisionPos, bool, MixedHash> mixed_map;
+        CollisionMap flat_map;
+        auto expected = replayStd(segments, old_map);
+        if (replayStd(segments, mixed_map) != expected || replayFlat(segments, flat_map) != expected)
+            throw std::runtime_error("Maps disagree on '" + path + "'");
+
+        volatile size_t sink = 0;
+        auto old_ns = nsPerMove(segments.size(), repetitions, [&] { sink = sink + replayStd(segments, old_map); });
+        auto mixed_ns = nsPerMove(segments.size(), repetitions, [&] { sink = sink + replayStd(segments, mixed_map); });
+        auto flat_ns = nsPerMove(segments.size(), repetitions, [&] { sink = sink + replayFlat(segments, flat_map); });
+        std::cout << path << "," << segments.size() << "," << positions.size() << "," << pos_hashes.size() << ","
+                  << old_ns << "," << mixed_ns << "," << flat_ns << "\n";
+    }
+}
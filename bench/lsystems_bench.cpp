@@ -0,0 +1,328 @@
+// Fixed-seed benchmarks of the hot paths of the model, from single operations on one tree up to whole runs of
+// 'Model::run'. Results are printed as CSV, one row per benchmark and configuration, so that the output of two
+// commits can be diffed: 'checksum' only depends on the seeds, so it must not change unless results do.
+//
+// Usage: lsystems_bench [min_seconds] [filter]
+//   min_seconds  Minimum time spent repeating each benchmark (default 0.5)
+//   filter       Only run the benchmarks whose name contains it
+//
+
+#include <iostream>
+#include <sstream>
+#include <filesystem>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "../src/parameters.h"
+#include "../src/genome.h"
+#include "../src/tree.h"
+#include "../src/forest.h"
+#include "../src/model.h"
+#include "../src/obj_writer.h"
+
+static constexpr unsigned int seed = 1234567;
+static constexpr unsigned int min_iterations = 3;
+
+struct Result {
+    unsigned long iterations = 0;
+    double mean_ns = 0;
+    double min_ns = std::numeric_limits<double>::infinity();
+    double checksum = 0;
+};
+
+/*!
+ * Runs 'setup' (untimed) and then 'body' (timed) until 'min_seconds' were spent in 'body'.
+ *
+ * 'body' returns a value derived from what it computed, kept as the checksum (and so it can't be optimized away).
+ */
+static Result measure(double min_seconds, const std::function<void()> &setup, const std::function<double()> &body) {
+    Result result;
+    double total_ns = 0;
+    while (result.iterations < min_iterations || total_ns < min_seconds * 1e9) {
+        setup();
+        auto start = std::chrono::steady_clock::now();
+        result.checksum = body();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        total_ns += elapsed.count();
+        result.min_ns = std::min(result.min_ns, elapsed.count());
+        result.iterations++;
+    }
+    result.mean_ns = total_ns / (double) result.iterations;
+    return result;
+}
+
+class Suite {
+public:
+    Suite(double min_seconds, std::string filter) : min_seconds(min_seconds), filter(std::move(filter)) {
+        std::cout << "benchmark,config,ops,iterations,mean_ns_per_op,min_ns_per_op,checksum\n";
+    }
+
+    bool selected(const std::string &name) const {
+        return name.find(filter) != std::string::npos;
+    }
+
+    //! Times 'body', which performs 'ops' operations per call.
+    void run(const std::string &name, const std::string &config, unsigned long ops,
+             const std::function<void()> &setup, const std::function<double()> &body) const {
+        if (!selected(name))
+            return;
+        auto result = measure(min_seconds, setup, body);
+        std::cout << name << "," << config << "," << ops << "," << result.iterations << ","
+                  << result.mean_ns / (double) ops << "," << result.min_ns / (double) ops << ","
+                  << std::fixed << result.checksum << std::defaultfloat << std::endl;
+    }
+
+private:
+    double min_seconds;
+    std::string filter;
+};
+
+//! Genomes of this size are used as fixtures (starting genomes are too small to develop interesting bodies).
+static unsigned int fixtureGenomeSize(const Parameters &parameters) {
+    return parameters.max_genome_size / 2;
+}
+
+//! Parameters of a model that runs quietly in a scratch directory.
+static Parameters modelParameters(const Parameters &defaults) {
+    Parameters parameters = defaults;
+    parameters.outdir = (std::filesystem::temp_directory_path() / "lsystems_bench").string();
+    parameters.replace_dir = true;
+    parameters.checkpoint_interval = 0;
+    parameters.stats_interval = 0;
+    // The default (one thread per core) would make timings depend on the machine
+    parameters.n_threads = 4;
+    return parameters;
+}
+
+//! Turns a hash into a checksum (doubles hold integers of up to 53 bits exactly).
+static double checksum(std::size_t hash) {
+    return (double) (hash >> 11);
+}
+
+static double geometryChecksum(const Tree &tree) {
+    std::size_t hash = 0;
+    for (const auto &[from, to] : tree.segments) {
+        for (const auto &pos : {from, to}) {
+            hashCombine(hash, std::hash<double>()(pos.x));
+            hashCombine(hash, std::hash<double>()(pos.y));
+            hashCombine(hash, std::hash<double>()(pos.z));
+        }
+    }
+    for (const auto &pos : tree.seeds) {
+        hashCombine(hash, std::hash<double>()(pos.x));
+        hashCombine(hash, std::hash<double>()(pos.y));
+        hashCombine(hash, std::hash<double>()(pos.z));
+    }
+    return checksum(hash);
+}
+
+/*!
+ * Tree (same for every run) with the longest body among the trees of an evolved population that branch and have
+ * seeds.
+ *
+ * Random genomes are no good as fixtures: they hardly ever have seeds, and the ones that develop long bodies mostly
+ * grow poles without a single branch.
+ */
+static Tree fixtureTree(const Parameters &defaults) {
+    auto parameters = modelParameters(defaults);
+    parameters.generations = 200;
+    Model model(parameters);
+    model.run();
+    model.forest.evaluate();
+    std::filesystem::remove_all(parameters.outdir);
+
+    const Tree *best = nullptr;
+    for (const auto &tree : model.forest.population) {
+        if (tree.over_budget || tree.seeds.empty())
+            continue;
+        Tree developed = tree.germinate();
+        developed.develop(developed.maturity);
+        if (std::find(developed.body.begin(), developed.body.end(), Genome::branch_open) == developed.body.end())
+            continue;
+        if (best == nullptr || tree.bodyLengthAfter(tree.maturity) > best->bodyLengthAfter(best->maturity))
+            best = &tree;
+    }
+    if (best == nullptr)
+        throw std::runtime_error("No tree of the evolved population branches and has seeds");
+    return best->germinate();
+}
+
+/*!
+ * Tree whose only gene expands into a copy of itself and a branch holding another copy and a seed, so that its body
+ * is made of the same motif repeated at every scale (the case the geometry cache is meant for).
+ */
+static Tree selfSimilarTree(unsigned int maturity) {
+    constexpr Gene motif = Genome::n_core_genes;
+    const std::vector<Gene> rule = {
+        motif, Genome::branch_open, Genome::x_pos, motif, Genome::seed, Genome::branch_close, motif
+    };
+    std::stringstream text;
+    text << "10 0 0 0 " << rule.size() << " 0.5 1\n";
+    writeVector(text, rule);
+    writeVector(text, std::vector<Gene> {motif});
+    return {{motif}, Genome::load(text), maturity};
+}
+
+static void treeBenchmarks(const Suite &suite, const Parameters &defaults) {
+    const std::string names[] = {"Tree::develop", "Tree::grow", "Tree::mature(develop+grow)", "Tree::mature(stream)",
+                                 "Tree::mature(stream+cache)", "Tree::segmentsAsOBJ"};
+    if (std::none_of(std::begin(names), std::end(names), [&suite](const auto &name) { return suite.selected(name); }))
+        return;
+    auto evolved = fixtureTree(defaults);
+    std::vector<std::pair<std::string, Tree>> fixtures;
+    // The same tree grown for longer too, so that its body is up to 'gene_activation_length' ^ 8 times longer
+    for (unsigned int maturity : {evolved.maturity, evolved.maturity + 8}) {
+        fixtures.emplace_back("evolved", evolved);
+        fixtures.back().second.maturity = maturity;
+    }
+    fixtures.emplace_back("self-similar", selfSimilarTree(8));
+
+    for (const auto &[name, fixture] : fixtures) {
+        Tree grown = fixture.germinate();
+        grown.mature();
+        auto config = name + " maturity=" + std::to_string(fixture.maturity) +
+                      " body=" + std::to_string(fixture.bodyLengthAfter(fixture.maturity)) +
+                      " seeds=" + std::to_string(grown.seeds.size());
+        Tree tree = fixture;
+
+        suite.run("Tree::develop", config, 1, [&] { tree = fixture.germinate(); }, [&] {
+            tree.develop(tree.maturity);
+            std::size_t hash = 0;
+            for (auto gene : tree.body)
+                hashCombine(hash, gene);
+            return checksum(hash);
+        });
+
+        Tree developed = fixture.germinate();
+        developed.develop(developed.maturity);
+        suite.run("Tree::grow", config, 1, [&] { tree = developed; }, [&] {
+            tree.grow();
+            return geometryChecksum(tree);
+        });
+
+        // Every way of maturing a tree, from the same germinated tree
+        const std::pair<std::string, std::pair<bool, bool>> modes[] = {
+            {"Tree::mature(develop+grow)", {false, false}},
+            {"Tree::mature(stream)", {true, false}},
+            {"Tree::mature(stream+cache)", {true, true}},
+        };
+        for (const auto &[benchmark, settings] : modes) {
+            suite.run(benchmark, config, 1, [&] {
+                tree = fixture.germinate();
+                tree.stream_development = settings.first;
+                tree.geometry_cache = settings.second;
+            }, [&] {
+                tree.mature();
+                return geometryChecksum(tree);
+            });
+        }
+
+        tree = developed;
+        tree.grow();
+        suite.run("Tree::segmentsAsOBJ", config + " segments=" + std::to_string(tree.segments.size()), 1, [] {}, [&] {
+            ObjWriter obj("/dev/null");
+            tree.segmentsAsOBJ(obj);
+            obj.close();
+            return (double) obj.vertices();
+        });
+    }
+}
+
+static void genomeBenchmarks(const Suite &suite, const Parameters &parameters) {
+    constexpr size_t n_genomes = 1000;
+    std::mt19937 rng(seed);
+    std::vector<Genome> fixtures;
+    for (size_t i = 0; i < n_genomes; i++) {
+        fixtures.emplace_back(fixtureGenomeSize(parameters), parameters.max_genome_size, parameters.mut_sub_rate,
+                              parameters.mut_dup_rate, parameters.mut_del_rate, parameters.gene_activation_length,
+                              rng);
+    }
+    std::vector<Genome> genomes;
+    suite.run("Genome::mutate", "size=" + std::to_string(fixtureGenomeSize(parameters)), n_genomes, [&] {
+        genomes = fixtures;
+    }, [&] {
+        // Every genome mutates with a stream of its own, as in 'Forest::evolve'
+        std::size_t hash = 0;
+        for (size_t i = 0; i < genomes.size(); i++) {
+            auto genome_rng = SplitMix64::stream(seed, i);
+            genomes[i].mutate(genome_rng);
+            hashCombine(hash, genomes[i].rulesHash());
+        }
+        return checksum(hash);
+    });
+}
+
+static void forestBenchmarks(const Suite &suite, const Parameters &defaults) {
+    if (!suite.selected("Forest::randomFitTree"))
+        return;
+    // Trees of a random population hardly ever have any fitness, so the forest is evolved for a while first
+    auto parameters = modelParameters(defaults);
+    parameters.generations = 200;
+    Model model(parameters);
+    model.run();
+    auto &forest = model.forest;
+    forest.evaluate();
+    forest.prepareSelection();
+
+    constexpr size_t n_draws = 100'000;
+    std::mt19937 rng;
+    auto config = "n_pop=" + std::to_string(parameters.n_pop) + " total_fitness=" +
+                  std::to_string((long) forest.total_fitness);
+    suite.run("Forest::randomFitTree", config, n_draws, [&] { rng.seed(seed); }, [&] {
+        double total = 0;
+        for (size_t i = 0; i < n_draws; i++)
+            total += (double) (&forest.randomFitTree(rng) - forest.population.data());
+        return total;
+    });
+    std::filesystem::remove_all(parameters.outdir);
+}
+
+static void modelBenchmarks(const Suite &suite, const Parameters &defaults) {
+    if (!suite.selected("Model::run"))
+        return;
+    for (unsigned int n_pop : {100, 500}) {
+        for (unsigned int maturity : {6, 8}) {
+            auto parameters = modelParameters(defaults);
+            parameters.generations = 50;
+            parameters.n_pop = n_pop;
+            parameters.maturity = maturity;
+            auto config = "n_pop=" + std::to_string(n_pop) + " maturity=" + std::to_string(maturity) +
+                          " generations=" + std::to_string(parameters.generations) +
+                          " n_threads=" + std::to_string(parameters.n_threads);
+
+            std::optional<Model> model;
+            suite.run("Model::run", config, parameters.generations, [&] {
+                model.reset();
+                model.emplace(parameters);
+            }, [&] {
+                model->run();
+                // Fitness alone is often still 0 after a few generations, the genomes and the geometry of the
+                // fittest tree always depend on the run
+                std::size_t hash = 0;
+                for (const auto &tree : model->forest.population)
+                    hashCombine(hash, tree.genome.rulesHash());
+                hashCombine(hash, std::hash<double>()(model->forest.fittest_ever->fitness));
+                // Records keep the tree as it germinated, so it's grown again
+                Tree fittest = model->forest.fittest_ever->tree;
+                fittest.mature();
+                hashCombine(hash, (std::size_t) geometryChecksum(fittest));
+                return checksum(hash);
+            });
+            std::filesystem::remove_all(parameters.outdir);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    double min_seconds = argc > 1 ? std::stod(argv[1]) : 0.5;
+    Suite suite(min_seconds, argc > 2 ? argv[2] : "");
+
+    Parameters parameters;
+    parameters.seed = seed;
+    treeBenchmarks(suite, parameters);
+    genomeBenchmarks(suite, parameters);
+    forestBenchmarks(suite, parameters);
+    modelBenchmarks(suite, parameters);
+}
@@ -0,0 +1,34 @@
+#include <algorithm>
+#include "arena.h"
+
+Arena::Arena(size_t block_size) : block_size(block_size) {}
+
+void *Arena::do_allocate(size_t bytes, size_t alignment) {
+    for (;; current++, offset = 0) {
+        if (current == blocks.size()) {
+            // Blocks double in size so that the number of blocks stays logarithmic
+            size_t size = std::max(block_size << std::min<size_t>(blocks.size(), 10), bytes + alignment);
+            blocks.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+        }
+        // If it doesn't fit, the rest of the block is wasted until the arena is rewound
+        auto &block = blocks[current];
+        void *ptr = block.data.get() + offset;
+        size_t space = block.size - offset;
+        if (std::align(alignment, bytes, ptr, space) != nullptr) {
+            offset = block.size - space + bytes;
+            return ptr;
+        }
+    }
+}
+
+size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const auto &block : blocks)
+        total += block.size;
+    return total;
+}
+
+Arena &Arena::local() {
+    static thread_local Arena arena;
+    return arena;
+}
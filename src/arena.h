@@ -0,0 +1,95 @@
+#ifndef L_SYSTEMS_ARENA_H
+#define L_SYSTEMS_ARENA_H
+
+#include <vector>
+#include <memory>
+#include <memory_resource>
+#include <cstddef>
+
+/*!
+ * Monotonic memory resource: allocating bumps a pointer and deallocating does nothing.
+ *
+ * Memory is taken from a list of blocks that are kept for the lifetime of the arena, so after the first few trees
+ * no allocation reaches the global heap. Everything allocated after a 'mark' is released at once (in O(1)) by
+ * rewinding to it, which makes nested scopes work as long as they are released in reverse order.
+ */
+class Arena : public std::pmr::memory_resource {
+public:
+    explicit Arena(size_t block_size = 1 << 20);
+
+    //! Position in the arena to rewind to.
+    struct Mark {
+        size_t block = 0;
+        size_t offset = 0;
+    };
+
+    Mark mark() const {
+        return {current, offset};
+    }
+
+    //! Releases everything allocated since 'mark' was taken (the blocks are kept).
+    void rewind(const Mark &mark) {
+        current = mark.block;
+        offset = mark.offset;
+    }
+
+    //! Bytes reserved from the global heap.
+    size_t capacity() const;
+
+    //! Arena of the calling thread.
+    static Arena &local();
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+
+    void do_deallocate(void *, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    struct Block {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    size_t block_size;
+    std::vector<Block> blocks;
+    // Block being allocated from and bytes of it already in use
+    size_t current = 0;
+    size_t offset = 0;
+};
+
+/*!
+ * Memory resource for the temporary containers of a piece of work.
+ *
+ * Uses the arena of the calling thread and gives back everything allocated from it once the scope ends, or
+ * the global heap if 'use_arena' is false. Scopes can nest, but must end in reverse order (on the same thread).
+ */
+class ArenaScope {
+public:
+    explicit ArenaScope(bool use_arena) : arena(use_arena ? &Arena::local() : nullptr) {
+        if (arena != nullptr)
+            start = arena->mark();
+    }
+
+    ~ArenaScope() {
+        if (arena != nullptr)
+            arena->rewind(start);
+    }
+
+    ArenaScope(const ArenaScope &) = delete;
+
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+    std::pmr::memory_resource *resource() const {
+        return arena != nullptr ? arena : std::pmr::new_delete_resource();
+    }
+
+private:
+    Arena *arena;
+    Arena::Mark start;
+};
+
+#endif //L_SYSTEMS_ARENA_H
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <filesystem>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include "batch.h"
+#include "model.h"
+
+Sweep Sweep::parse(const std::string &text) {
+    auto equals = text.find('=');
+    if (equals == std::string::npos || equals == 0 || equals + 1 == text.size())
+        throw std::invalid_argument("Expected 'name=value,value,...' but got '" + text + "'");
+    Sweep sweep = {text.substr(0, equals), {}};
+    size_t begin = equals + 1;
+    while (true) {
+        auto comma = text.find(',', begin);
+        sweep.values.push_back(text.substr(begin, comma - begin));
+        if (comma == std::string::npos)
+            break;
+        begin = comma + 1;
+    }
+    return sweep;
+}
+
+size_t runBatch(const Parameters &base, const std::vector<Sweep> &sweeps) {
+    for (const auto &sweep : sweeps) {
+        if (sweep.name == "n_threads")
+            throw std::invalid_argument("'n_threads' can't be swept, all the models of a batch share one pool");
+    }
+    // Every point of the grid, checked before running anything so that typos fail fast
+    std::vector<Parameters> points;
+    std::vector<size_t> choice(sweeps.size(), 0);
+    while (true) {
+        Parameters parameters = base;
+        std::string name;
+        for (size_t k = 0; k < sweeps.size(); k++) {
+            const auto &value = sweeps[k].values[choice[k]];
+            parameters.set(sweeps[k].name, value);
+            name += (k > 0 ? "_" : "") + sweeps[k].name + "=" + value;
+        }
+        parameters.outdir = base.outdir + "/" + name;
+        // Models run at the same time, so their output would be mixed up
+        parameters.log_to_file = true;
+        points.push_back(parameters);
+
+        // Next combination, the last sweep changing fastest
+        size_t k = sweeps.size();
+        while (k > 0 && ++choice[k - 1] == sweeps[k - 1].values.size())
+            choice[--k] = 0;
+        if (k == 0)
+            break;
+    }
+
+    if (!std::filesystem::create_directory(base.outdir) && !base.replace_dir)
+        throw std::runtime_error("Directory " + base.outdir + " already exists.");
+    std::cout << "Running " << points.size() << " models in '" << base.outdir << "'\n";
+
+    auto thread_pool = std::make_shared<ThreadPool>(base.n_threads);
+    std::mutex output_mutex;
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> failed = 0;
+    // Models run on threads of their own (not as tasks of the pool, or a thread waiting for the work of one model
+    // could start another one and nest it inside that wait), and their work is spread across the shared pool
+    std::vector<std::thread> drivers;
+    for (size_t k = 0; k < std::min<size_t>(points.size(), thread_pool->size()); k++) {
+        drivers.emplace_back([&] {
+            for (size_t i = next++; i < points.size(); i = next++) {
+                try {
+                    Model model(points[i], thread_pool);
+                    model.run();
+                    model.saveData();
+                    std::lock_guard lock(output_mutex);
+                    std::cout << "Finished '" << points[i].outdir << "' (best fitness = "
+                              << model.forest.fittest_ever->fitness << ")\n";
+                } catch (const std::exception &e) {
+                    failed++;
+                    std::lock_guard lock(output_mutex);
+                    std::cerr << "Failed '" << points[i].outdir << "': " << e.what() << "\n";
+                }
+            }
+        });
+    }
+    for (auto &driver : drivers)
+        driver.join();
+    return failed;
+}
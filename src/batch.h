@@ -0,0 +1,27 @@
+#ifndef L_SYSTEMS_BATCH_H
+#define L_SYSTEMS_BATCH_H
+
+#include <string>
+#include <vector>
+#include "parameters.h"
+
+//! Values a parameter takes in a batch.
+struct Sweep {
+    //! Reads "name=value,value,...".
+    static Sweep parse(const std::string &text);
+
+    std::string name;
+    std::vector<std::string> values;
+};
+
+/*!
+ * Runs a model for every combination of the values in 'sweeps' (the other parameters are taken from 'base').
+ *
+ * All models run in this process and share one thread pool of 'base.n_threads' threads (so 'n_threads' can't be
+ * swept). At most that many models run at a time, each driven by a thread of its own. Each model writes to its own
+ * directory inside 'base.outdir', named after the values it was given, and prints its stats to "log.txt" there. A
+ * model that fails is reported and doesn't stop the others. Returns the number of models that failed.
+ */
+size_t runBatch(const Parameters &base, const std::vector<Sweep> &sweeps);
+
+#endif //L_SYSTEMS_BATCH_H
@@ -0,0 +1,59 @@
+#ifndef L_SYSTEMS_BOUNDED_QUEUE_H
+#define L_SYSTEMS_BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <condition_variable>
+
+/*!
+ * FIFO queue holding at most 'capacity' items, used to pass values between threads.
+ *
+ * 'push' blocks while the queue is full and 'pop' while it is empty, until the queue is closed, after which
+ * both return immediately (so a thread that fails can release the ones waiting on it).
+ */
+template<class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    //! Returns false (dropping 'value') if the queue was closed.
+    bool push(T value) {
+        std::unique_lock lock(mutex);
+        not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed)
+            return false;
+        items.push_back(std::move(value));
+        not_empty.notify_one();
+        return true;
+    }
+
+    //! Returns nothing if the queue was closed.
+    std::optional<T> pop() {
+        std::unique_lock lock(mutex);
+        not_empty.wait(lock, [this] { return closed || !items.empty(); });
+        if (closed)
+            return {};
+        T value = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return value;
+    }
+
+    void close() {
+        std::lock_guard lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    bool closed = false;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+};
+
+#endif //L_SYSTEMS_BOUNDED_QUEUE_H
@@ -0,0 +1,111 @@
+#include <fstream>
+#include <iomanip>
+#include <filesystem>
+#include <stdexcept>
+#include "checkpoint.h"
+
+static const std::string header = "L_systems checkpoint 3";
+
+Checkpoint Checkpoint::take(
+    unsigned int generation,
+    const std::mt19937 &rng,
+    const std::vector<std::mt19937> &island_rngs,
+    const Forest &forest
+) {
+    return {
+        generation,
+        rng,
+        island_rngs,
+        forest.population,
+        forest.fittest_ever,
+        forest.fittest_currently,
+        forest.total_fitness,
+        forest.evaluation_cache_hits,
+        forest.evaluation_cache_misses,
+        forest.over_budget_trees
+    };
+}
+
+void Checkpoint::restore(std::mt19937 &rng_out, std::vector<std::mt19937> &island_rngs_out, Forest &forest) const {
+    rng_out = rng;
+    island_rngs_out = island_rngs;
+    forest.population = population;
+    forest.populationChanged();
+    forest.fittest_ever = fittest_ever;
+    forest.fittest_currently = fittest_currently;
+    forest.total_fitness = total_fitness;
+    forest.evaluation_cache_hits = evaluation_cache_hits;
+    forest.evaluation_cache_misses = evaluation_cache_misses;
+    forest.over_budget_trees = over_budget_trees;
+}
+
+static void saveRecord(std::ostream &out, const std::optional<FitnessRecord> &record) {
+    out << record.has_value() << "\n";
+    if (!record.has_value())
+        return;
+    out << record->fitness << "\n";
+    record->tree.save(out);
+}
+
+static std::optional<FitnessRecord> loadRecord(std::istream &in) {
+    bool has_value = false;
+    in >> has_value;
+    if (!has_value)
+        return {};
+    double fitness = 0;
+    in >> fitness;
+    return FitnessRecord{Tree::load(in), fitness};
+}
+
+void Checkpoint::save(const std::string &path) const {
+    auto tmp_path = path + ".tmp";
+    std::ofstream file(tmp_path);
+    file << std::setprecision(std::numeric_limits<double>::max_digits10);
+    file << header << "\n";
+    file << generation << "\n";
+    file << rng << "\n";
+    file << island_rngs.size() << "\n";
+    for (const auto &island_rng : island_rngs)
+        file << island_rng << "\n";
+    file << total_fitness << " " << evaluation_cache_hits << " " << evaluation_cache_misses << " "
+         << over_budget_trees << "\n";
+    file << population.size() << "\n";
+    for (const auto &tree : population)
+        tree.save(file);
+    saveRecord(file, fittest_ever);
+    saveRecord(file, fittest_currently);
+    file.close();
+    if (!file)
+        throw std::runtime_error("Could not write checkpoint to '" + tmp_path + "'");
+    std::filesystem::rename(tmp_path, path);
+}
+
+Checkpoint Checkpoint::load(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Could not open checkpoint '" + path + "'");
+    std::string line;
+    std::getline(file, line);
+    if (line != header)
+        throw std::runtime_error("'" + path + "' is not a checkpoint");
+
+    Checkpoint checkpoint;
+    size_t n_islands = 0, n_trees = 0;
+    file >> checkpoint.generation >> checkpoint.rng >> n_islands;
+    checkpoint.island_rngs.resize(n_islands);
+    for (auto &island_rng : checkpoint.island_rngs)
+        file >> island_rng;
+    file >> checkpoint.total_fitness >> checkpoint.evaluation_cache_hits >> checkpoint.evaluation_cache_misses
+         >> checkpoint.over_budget_trees;
+    file >> n_trees;
+    if (!file)
+        throw std::runtime_error("Could not read checkpoint '" + path + "'");
+    checkpoint.population.reserve(n_trees);
+    for (size_t i = 0; i < n_trees; i++)
+        checkpoint.population.push_back(Tree::load(file));
+    checkpoint.fittest_ever = loadRecord(file);
+    checkpoint.fittest_currently = loadRecord(file);
+    if (!file)
+        throw std::runtime_error("Could not read checkpoint '" + path + "'");
+    return checkpoint;
+}
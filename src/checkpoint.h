@@ -0,0 +1,45 @@
+#ifndef L_SYSTEMS_CHECKPOINT_H
+#define L_SYSTEMS_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <optional>
+#include <random>
+#include "forest.h"
+
+/*!
+ * Everything needed to continue an evolution exactly where it was left.
+ *
+ * Checkpoints are taken between generations, when the population was just germinated, so they only hold genomes
+ * and seedlings (geometry is grown again when evolution continues).
+ */
+struct Checkpoint {
+    //! Takes a snapshot of 'forest' after 'generation' generations ('island_rngs' is empty unless using islands).
+    static Checkpoint take(
+        unsigned int generation,
+        const std::mt19937 &rng,
+        const std::vector<std::mt19937> &island_rngs,
+        const Forest &forest
+    );
+
+    //! Puts the state of the snapshot back into 'rng', 'island_rngs' and 'forest'.
+    void restore(std::mt19937 &rng, std::vector<std::mt19937> &island_rngs, Forest &forest) const;
+
+    //! Writes the checkpoint to 'path' through a temporary file, so 'path' always holds a complete checkpoint.
+    void save(const std::string &path) const;
+
+    static Checkpoint load(const std::string &path);
+
+    unsigned int generation = 0;
+    std::mt19937 rng;
+    std::vector<std::mt19937> island_rngs;
+    std::vector<Tree> population;
+    std::optional<FitnessRecord> fittest_ever;
+    std::optional<FitnessRecord> fittest_currently;
+    double total_fitness = 0;
+    unsigned long evaluation_cache_hits = 0;
+    unsigned long evaluation_cache_misses = 0;
+    unsigned long over_budget_trees = 0;
+};
+
+#endif //L_SYSTEMS_CHECKPOINT_H
@@ -0,0 +1,56 @@
+#include "collision_map.h"
+
+static constexpr size_t initial_capacity = 1 << 10;
+
+CollisionMap::CollisionMap() : slots(initial_capacity), mask(initial_capacity - 1) {}
+
+size_t CollisionMap::probe(const CollisionPos &pos) const {
+    size_t slot = hash(pos) & mask;
+    while (slots[slot].stamp == generation && !(slots[slot].pos == pos))
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+bool *CollisionMap::find(const CollisionPos &pos) {
+    auto &slot = slots[probe(pos)];
+    return slot.stamp == generation ? &slot.value : nullptr;
+}
+
+bool CollisionMap::insert(const CollisionPos &pos, bool value) {
+    auto slot = probe(pos);
+    if (slots[slot].stamp == generation)
+        return false;
+
+    // Keeps the load factor under 1/2
+    if (2 * (order.size() + 1) > slots.size()) {
+        grow();
+        slot = probe(pos);
+    }
+    slots[slot] = {pos, generation, value};
+    order.push_back(slot);
+    return true;
+}
+
+void CollisionMap::clear() {
+    order.clear();
+    if (++generation == 0) {
+        // Stamps wrapped around, old entries could look alive again
+        for (auto &slot : slots)
+            slot.stamp = 0;
+        generation = 1;
+    }
+}
+
+void CollisionMap::grow() {
+    std::vector<Slot> old_slots(slots.size() * 2);
+    std::swap(slots, old_slots);
+    mask = slots.size() - 1;
+
+    // The new slots are all unstamped, so stamps can start over
+    generation = 1;
+    for (auto &slot : order) {
+        const auto &old_slot = old_slots[slot];
+        slot = probe(old_slot.pos);
+        slots[slot] = {old_slot.pos, generation, old_slot.value};
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef L_SYSTEMS_COLLISION_MAP_H
+#define L_SYSTEMS_COLLISION_MAP_H
+
+#include <vector>
+#include <cstdint>
+#include "pos.h"
+
+/*!
+ * Flat open-addressing map from 'CollisionPos' to a flag (whether a seed counts at that position).
+ *
+ * Entries live in a single array probed linearly, hashed with a proper mix of the three coordinates.
+ * 'clear' is O(1) and keeps the memory, so one map can be reused for many trees.
+ * Iteration follows insertion order.
+ */
+class CollisionMap {
+public:
+    CollisionMap();
+
+    //! Flag of 'pos', or nullptr if it's not in the map.
+    bool *find(const CollisionPos &pos);
+
+    //! Inserts 'pos' with 'value' if it's not in the map yet. Returns whether it was inserted.
+    bool insert(const CollisionPos &pos, bool value);
+
+    size_t size() const {
+        return order.size();
+    }
+
+    void clear();
+
+    //! Calls 'func(pos, value)' for every entry in insertion order.
+    template<class Func>
+    void forEach(Func func) const {
+        for (auto slot : order)
+            func(slots[slot].pos, slots[slot].value);
+    }
+
+    static std::uint64_t hash(const CollisionPos &pos) {
+        std::uint64_t h = std::uint64_t(std::uint32_t(pos.x)) * 0x9e3779b97f4a7c15;
+        h ^= std::uint64_t(std::uint32_t(pos.y)) * 0xc2b2ae3d27d4eb4f;
+        h ^= std::uint64_t(std::uint32_t(pos.z)) * 0x165667b19e3779f9;
+        // Finalizer of MurmurHash3
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccd;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    struct Slot {
+        CollisionPos pos;
+        // The slot is in use if it matches 'generation'
+        std::uint32_t stamp;
+        bool value;
+    };
+
+    //! Slot holding 'pos' or the empty slot where it should go.
+    size_t probe(const CollisionPos &pos) const;
+
+    void grow();
+
+    std::vector<Slot> slots;
+    // Indices of the slots in use, in insertion order
+    std::vector<std::uint32_t> order;
+    std::uint32_t generation = 1;
+    size_t mask;
+};
+
+#endif //L_SYSTEMS_COLLISION_MAP_H
@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include "compressed_body.h"
+
+CompressedBody::CompressedBody(
+    Genome genome,
+    std::vector<Gene> root,
+    unsigned int stages
+) : genome(std::move(genome)),
+    root(std::move(root)),
+    stages(stages),
+    balances(this->genome.branchBalances(stages)) {
+    constexpr auto max_length = std::numeric_limits<std::uint64_t>::max();
+    auto lengths = this->genome.expansionLengths(stages);
+    size_t n_genes = this->genome.geneIdBound();
+    longest = 0;
+    for (unsigned int k = 0; k <= stages; k++) {
+        length = 0;
+        for (auto gene : this->root) {
+            auto gene_length = gene < n_genes ? lengths[k * n_genes + gene] : 1;
+            length = gene_length > max_length - length ? max_length : length + gene_length;
+        }
+        longest = std::max(longest, length);
+    }
+}
+
+std::vector<Gene> CompressedBody::expand() const {
+    if (length > std::vector<Gene>().max_size())
+        throw std::length_error("Body has " + std::to_string(length) + " genes");
+    std::vector<Gene> genes;
+    genes.reserve(length);
+    for (auto gene : *this)
+        genes.push_back(gene);
+    return genes;
+}
+
+CompressedBody::Iterator::Iterator(const CompressedBody &body) : body(&body) {
+    stack.reserve(body.stages + 1);
+    stack.push_back({body.root.data(), body.root.data() + body.root.size(), body.stages});
+    settle();
+}
+
+void CompressedBody::Iterator::settle() {
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.it == top.end) {
+            stack.pop_back();
+            if (!stack.empty())
+                stack.back().it++;
+            continue;
+        }
+        if (*top.it == Genome::no_gene) {
+            top.it++;
+            continue;
+        }
+        auto targets = expansion(*top.it, top.stage);
+        if (targets.empty())
+            return;
+        stack.push_back({targets.data(), targets.data() + targets.size(), top.stage - 1});
+    }
+}
+
+void CompressedBody::Iterator::skipBranch() {
+    size_t n_genes = body->genome.geneIdBound();
+    std::int64_t nest = 0;
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (top.it == top.end) {
+            stack.pop_back();
+            if (!stack.empty())
+                stack.back().it++;
+            continue;
+        }
+        auto gene = *top.it;
+        if (gene == Genome::no_gene) {
+            top.it++;
+            continue;
+        }
+        auto targets = expansion(gene, top.stage);
+        if (!targets.empty()) {
+            // The whole expansion can be skipped if it never closes more branches than are open
+            const auto &balance = body->balances[top.stage * n_genes + gene];
+            if (nest + balance.lowest >= 0) {
+                nest += balance.net;
+                top.it++;
+            } else {
+                stack.push_back({targets.data(), targets.data() + targets.size(), top.stage - 1});
+            }
+            continue;
+        }
+        if (gene == Genome::branch_close) {
+            if (nest == 0)
+                return;
+            nest--;
+        } else if (gene == Genome::branch_open) {
+            nest++;
+        }
+        top.it++;
+    }
+}
@@ -0,0 +1,109 @@
+#ifndef L_SYSTEMS_COMPRESSED_BODY_H
+#define L_SYSTEMS_COMPRESSED_BODY_H
+
+#include <vector>
+#include <iterator>
+#include <cstdint>
+#include "genome.h"
+
+/*!
+ * Body of a tree kept as the derivation that produces it: a few root genes expanded 'stages' times by the rules
+ * of a genome.
+ *
+ * This is the grammar the L-system already is, so it takes the memory of the genome no matter how long the body
+ * is. Genes are produced on demand by walking the derivation depth-first.
+ */
+class CompressedBody {
+public:
+    CompressedBody(Genome genome, std::vector<Gene> root, unsigned int stages);
+
+    //! Reads the body gene by gene (memory proportional to 'stages').
+    class Iterator {
+    public:
+        using value_type = Gene;
+        using difference_type = std::ptrdiff_t;
+
+        Iterator() = default;
+
+        explicit Iterator(const CompressedBody &body);
+
+        Gene operator*() const {
+            return *stack.back().it;
+        }
+
+        Iterator &operator++() {
+            stack.back().it++;
+            settle();
+            return *this;
+        }
+
+        void operator++(int) {
+            ++*this;
+        }
+
+        bool operator==(std::default_sentinel_t) const {
+            return stack.empty();
+        }
+
+        /*!
+         * Moves to the first "]" (from the current gene included) that closes a branch opened before it.
+         *
+         * Same as jumping with 'Tree::branchEnds', but pieces of the derivation that can't contain that "]" are skipped whole.
+         */
+        void skipBranch();
+
+    private:
+        struct Frame {
+            const Gene *it;
+            const Gene *end;
+            unsigned int stage;
+        };
+
+        //! Descends until the current gene is one that is not expanded any more.
+        void settle();
+
+        //! Genes 'gene' expands into at 'stage' (empty if it's not expanded).
+        std::span<const Gene> expansion(Gene gene, unsigned int stage) const {
+            return stage > 0 ? body->genome.geneActivates(gene) : std::span<const Gene>();
+        }
+
+        const CompressedBody *body = nullptr;
+        std::vector<Frame> stack;
+    };
+
+    Iterator begin() const {
+        return Iterator(*this);
+    }
+
+    std::default_sentinel_t end() const {
+        return {};
+    }
+
+    //! Number of genes in the body (saturates instead of overflowing).
+    std::uint64_t size() const {
+        return length;
+    }
+
+    /*!
+     * Number of genes in the longest of the bodies derived at each stage, the root included (saturates).
+     *
+     * Bodies can shrink from one stage to the next once genes lost targets to deletions.
+     */
+    std::uint64_t longestStage() const {
+        return longest;
+    }
+
+    //! The body as an explicit list of genes.
+    std::vector<Gene> expand() const;
+
+    const Genome genome;
+    const std::vector<Gene> root;
+    const unsigned int stages;
+
+private:
+    std::pmr::vector<BranchBalance> balances;
+    std::uint64_t length;
+    std::uint64_t longest;
+};
+
+#endif //L_SYSTEMS_COMPRESSED_BODY_H
@@ -5,7 +5,12 @@
 #include <iostream>
 #include <fstream>
 #include <regex>
+#include <unordered_map>
+#include <numeric>
+#include <algorithm>
 #include "forest.h"
+#include "geometry_file.h"
+#include "instrumentation.h"
 
 Forest::Forest(
     unsigned int n,
@@ -37,27 +42,173 @@ Forest::Forest(
 }
 
 void Forest::evolve(std::mt19937 &rng) {
-    for (auto &tree : population) {
-        tree.develop(tree.maturity);
-        tree.grow();
-        tree.genome.mutate(rng);
+    if (!evaluated)
+        evaluate();
+    // Before mutating, so that the records hold the genomes that reached their fitness
+    updateFittest();
+
+    // Each tree mutates with its own stream so that results don't depend on how trees are split across threads
+    unsigned int generation_seed = rng();
+    {
+        INSTRUMENT_SCOPE(mutate);
+        parallelFor(population.size(), [this, generation_seed](size_t i) {
+            auto tree_rng = SplitMix64::stream(generation_seed, i);
+            population[i].genome.mutate(tree_rng);
+        });
     }
 
-    total_fitness = 0.;
-    for (const auto &tree : population)
-        total_fitness += tree.fitness();
+    prepareSelection();
+    auto parents = selectParents(population.size(), rng);
+    INSTRUMENT_SCOPE(germination);
+    if (offspring.size() != population.size()) {
+        offspring.clear();
+        offspring.reserve(population.size());
+        for (auto parent : parents)
+            offspring.push_back(population[parent].germinate());
+    } else {
+        parallelFor(population.size(), [this, &parents](size_t i) {
+            population[parents[i]].germinateInto(offspring[i]);
+        });
+    }
+    std::swap(population, offspring);
+    evaluated = false;
+}
+
+void Forest::updateFittest() {
+    INSTRUMENT_SCOPE(fitness);
+    if (population.empty())
+        return;
+    size_t best = 0;
+    for (size_t i = 1; i < population.size(); i++) {
+        if (population[i].fitness() > population[best].fitness())
+            best = i;
+    }
+
+    const auto &tree = population[best];
+    fittest_currently = {tree.germinate(), tree.fitness()};
+    if (!fittest_ever.has_value() || tree.fitness() > fittest_ever->fitness)
+        fittest_ever = fittest_currently;
+}
+
+std::vector<size_t> Forest::fitnessRanking() const {
+    std::vector<size_t> ranking(population.size());
+    std::iota(ranking.begin(), ranking.end(), 0);
+    std::stable_sort(ranking.begin(), ranking.end(), [this](size_t a, size_t b) {
+        return population[a].fitness() > population[b].fitness();
+    });
+    return ranking;
+}
+
+std::vector<Tree> Forest::fittest(size_t n) {
+    if (!evaluated)
+        evaluate();
+    auto ranking = fitnessRanking();
+    std::vector<Tree> trees;
+    for (size_t i = 0; i < std::min(n, ranking.size()); i++)
+        trees.push_back(population[ranking[i]]);
+    return trees;
+}
+
+void Forest::replaceLeastFit(std::vector<Tree> trees) {
+    if (!evaluated)
+        evaluate();
+    auto ranking = fitnessRanking();
+    for (size_t i = 0; i < std::min(trees.size(), ranking.size()); i++)
+        population[ranking[ranking.size() - 1 - i]] = std::move(trees[i]);
+}
+
+void Forest::copySettings(Forest &other) const {
+    other.thread_pool = thread_pool;
+    other.evaluation_cache = evaluation_cache;
+    other.selection = selection;
+    other.tournament_size = tournament_size;
+    other.competition = competition;
+    other.shading = shading;
+    other.tree_spacing = tree_spacing;
+    other.shade_cell_size = shade_cell_size;
+}
+
+void Forest::evaluate() {
+    INSTRUMENT_SCOPE(evaluate);
+    // Index of the tree each tree copies its growth from (itself if it has to mature)
+    std::vector<size_t> source(population.size());
+    std::vector<size_t> to_mature;
+    if (evaluation_cache) {
+        std::vector<std::size_t> hashes(population.size());
+        parallelFor(population.size(), [this, &hashes](size_t i) {
+            hashes[i] = population[i].evaluationHash();
+        });
+
+        // Evaluation hash -> index of the first tree evaluated with it
+        std::unordered_map<std::size_t, size_t> first_evaluation;
+        for (size_t i = 0; i < population.size(); i++) {
+            auto [search, inserted] = first_evaluation.emplace(hashes[i], i);
+            source[i] = !inserted && population[search->second].sameEvaluation(population[i]) ? search->second : i;
+            if (source[i] == i)
+                to_mature.push_back(i);
+        }
+    } else {
+        for (size_t i = 0; i < population.size(); i++)
+            to_mature.push_back(source[i] = i);
+    }
 
-    std::vector<Tree> new_population;
-    for (size_t _ = 0; _ < population.size(); _++) {
-        auto &tree = randomFitTree(rng);
-        new_population.push_back(tree.germinate());
+    parallelFor(to_mature.size(), [this, &to_mature](size_t i) {
+        population[to_mature[i]].mature(thread_pool.get());
+    });
+    parallelFor(population.size(), [this, &source](size_t i) {
+        if (source[i] != i)
+            population[i].copyGrowth(population[source[i]]);
+    });
+
+    evaluation_cache_misses += to_mature.size();
+    evaluation_cache_hits += population.size() - to_mature.size();
+    over_budget_trees += std::count_if(population.begin(), population.end(), [](const Tree &tree) {
+        return tree.over_budget;
+    });
+
+    if (competition)
+        compete();
+    evaluated = true;
+}
+
+void Forest::compete() {
+    static constexpr size_t trees_per_part = 64;
+    size_t n_parts = (population.size() + trees_per_part - 1) / trees_per_part;
+    if (n_parts == 0)
+        return;
+    std::vector<ForestGrid> parts(n_parts, ForestGrid(shade_cell_size));
+    parallelFor(n_parts, [this, &parts](size_t part) {
+        size_t end = std::min(population.size(), (part + 1) * trees_per_part);
+        for (size_t i = part * trees_per_part; i < end; i++)
+            parts[part].addTree(i, treeOffset(i), population[i].segments);
+    });
+    // Pairwise reduction, every level merges disjoint pairs of grids
+    for (size_t step = 1; step < n_parts; step *= 2) {
+        parallelFor((n_parts + 2 * step - 1) / (2 * step), [&parts, n_parts, step](size_t pair) {
+            size_t part = pair * 2 * step;
+            if (part + step < n_parts)
+                parts[part].merge(parts[part + step]);
+        });
+    }
+
+    const auto &grid = parts.front();
+    parallelFor(population.size(), [this, &grid](size_t i) {
+        auto &tree = population[i];
+        auto offset = treeOffset(i);
+        auto shaded = std::count_if(tree.seeds.begin(), tree.seeds.end(), [&grid, &offset, i](const Pos &seed) {
+            return grid.shaded(i, offset, seed);
+        });
+        tree.shade = shading * (double) shaded;
+    });
+}
 
-        if (!fittest_currently.has_value() || tree.fitness() > fittest_currently.value().fitness())
-            fittest_currently = tree;
-        if (!fittest_ever.has_value() || tree.fitness() > fittest_ever.value().fitness())
-            fittest_ever = tree;
+void Forest::parallelFor(size_t n, const std::function<void(size_t)> &func) {
+    if (thread_pool) {
+        thread_pool->parallelFor(n, func);
+        return;
     }
-    population = new_population;
+    for (size_t i = 0; i < n; i++)
+        func(i);
 }
 
 Tree &Forest::randomTree(std::mt19937 &rng) {
@@ -65,26 +216,121 @@ Tree &Forest::randomTree(std::mt19937 &rng) {
 }
 
 Tree &Forest::randomFitTree(std::mt19937 &rng) {
+    if (cumulative_fitness.size() != population.size())
+        throw std::runtime_error("'prepareSelection' must be called before selecting trees");
+
     double rnd = total_fitness * uniform_random(rng);
-    for (auto &tree: population) {
-        if (rnd <= tree.fitness()) {
-            return tree;
-        }
-        rnd -= tree.fitness();
-    }
+    auto search = std::lower_bound(cumulative_fitness.begin(), cumulative_fitness.end(), rnd);
+    if (search != cumulative_fitness.end())
+        return population[search - cumulative_fitness.begin()];
     // All plants have 0 fitness, just pick a random one
     return randomTree(rng);
 }
 
+void Forest::prepareSelection() {
+    INSTRUMENT_SCOPE(fitness);
+    cumulative_fitness.resize(population.size());
+    total_fitness = 0.;
+    for (size_t i = 0; i < population.size(); i++) {
+        total_fitness += population[i].fitness();
+        cumulative_fitness[i] = total_fitness;
+    }
+
+    if (selection != Selection::alias)
+        return;
+    // Vose's algorithm: splits the probabilities in 'n' equal columns, each made of at most two trees
+    size_t n = population.size();
+    alias_chance.assign(n, 1.);
+    alias.resize(n);
+    std::iota(alias.begin(), alias.end(), 0);
+    if (total_fitness <= 0.)
+        return;
+    std::vector<double> scaled(n);
+    std::vector<size_t> small, large;
+    for (size_t i = 0; i < n; i++) {
+        scaled[i] = population[i].fitness() * (double) n / total_fitness;
+        (scaled[i] < 1. ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+        auto less = small.back();
+        small.pop_back();
+        auto more = large.back();
+        alias_chance[less] = scaled[less];
+        alias[less] = more;
+        scaled[more] -= 1. - scaled[less];
+        if (scaled[more] < 1.) {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+}
+
+size_t Forest::aliasDraw(std::mt19937 &rng) const {
+    auto i = std::uniform_int_distribution<size_t>(0, population.size() - 1)(rng);
+    return uniform_random(rng) < alias_chance[i] ? i : alias[i];
+}
+
+std::vector<size_t> Forest::selectParents(size_t n, std::mt19937 &rng) {
+    INSTRUMENT_SCOPE(selection);
+    std::vector<size_t> parents;
+    parents.reserve(n);
+    switch (selection) {
+        case Selection::roulette:
+            for (size_t i = 0; i < n; i++)
+                parents.push_back(&randomFitTree(rng) - population.data());
+            break;
+        case Selection::alias:
+            for (size_t i = 0; i < n; i++)
+                parents.push_back(aliasDraw(rng));
+            break;
+        case Selection::universal: {
+            if (total_fitness <= 0.) {
+                for (size_t i = 0; i < n; i++)
+                    parents.push_back(&randomTree(rng) - population.data());
+                break;
+            }
+            double step = total_fitness / (double) n;
+            double pointer = step * uniform_random(rng);
+            size_t tree = 0;
+            for (size_t i = 0; i < n; i++, pointer += step) {
+                while (tree + 1 < population.size() && cumulative_fitness[tree] < pointer)
+                    tree++;
+                parents.push_back(tree);
+            }
+            // Parents come out in population order, which later steps would pick up as a bias by position
+            std::shuffle(parents.begin(), parents.end(), rng);
+            break;
+        }
+        case Selection::tournament:
+            for (size_t i = 0; i < n; i++) {
+                size_t best = &randomTree(rng) - population.data();
+                for (unsigned int k = 1; k < tournament_size; k++) {
+                    size_t challenger = &randomTree(rng) - population.data();
+                    if (population[challenger].fitness() > population[best].fitness())
+                        best = challenger;
+                }
+                parents.push_back(best);
+            }
+            break;
+    }
+    return parents;
+}
+
 void Forest::printStats() {
     unsigned int tot_gen_size = 0;
     for (const auto &tree : population)
         tot_gen_size += tree.genome.size();
 
-    std::cout << "Mean genome size: " << tot_gen_size / (double) population.size() << "\n";
-    std::cout << "Mean fitness: " << total_fitness / (double) population.size() << "\n";
+    *log << "Mean genome size: " << tot_gen_size / (double) population.size() << "\n";
+    *log << "Mean fitness: " << total_fitness / (double) population.size() << "\n";
     if (fittest_ever.has_value())
-        std::cout << "Best fitness: " << fittest_ever.value().fitness() << "\n";
+        *log << "Best fitness: " << fittest_ever->fitness << "\n";
+    auto evaluations = evaluation_cache_hits + evaluation_cache_misses;
+    if (evaluations > 0)
+        *log << "Evaluation cache hits: " << evaluation_cache_hits << " / " << evaluations << " ("
+                  << 100. * (double) evaluation_cache_hits / (double) evaluations << "%)\n";
+    if (over_budget_trees > 0)
+        *log << "Trees over budget: " << over_budget_trees << " / " << evaluations << "\n";
 }
 
 void Forest::saveFittest(const std::string &outdir) {
@@ -92,60 +338,82 @@ void Forest::saveFittest(const std::string &outdir) {
         throw std::runtime_error("Forest does not have a fittest plant, "
                                  "did you evolve the population at least once?");
 
-    auto fittest = fittest_ever.value();
+    // The body is needed too, but it's read straight from its derivation instead of being developed
+    auto fittest = fittest_ever->tree;
+    auto body = fittest.compressedBody();
+    fittest.grow(body);
     std::ofstream file;
 
     file.open(outdir + "/fittest_body.txt");
-    file << vecToStr(fittest.body, "") << "\n";
+    // Bodies over budget can be far too long to write
+    if (!fittest.over_budget) {
+        for (auto gene : body)
+            file << Genome::geneToString(gene);
+    }
+    file << "\n";
     file.close();
 
     file.open(outdir + "/fittest_genome.txt");
     file << fittest.genome.stringRepresentation();
     file.close();
 
-    file.open(outdir + "/fittest_segments.obj");
-    file << fittest.segmentsAsOBJ();
-    file.close();
+    ObjWriter segments_obj(outdir + "/fittest_segments.obj");
+    fittest.segmentsAsOBJ(segments_obj);
+    segments_obj.close();
 
-    file.open(outdir + "/fittest_seeds.obj");
-    file << fittest.seedsAsOBJ();
-    file.close();
+    ObjWriter seeds_obj(outdir + "/fittest_seeds.obj");
+    fittest.seedsAsOBJ(seeds_obj);
+    seeds_obj.close();
 
-    std::cout << "Saved information about fittest tree (fitness = " <<
-              fittest.fitness() << ") to: '" << outdir << "'\n";
+    *log << "Saved information about fittest tree (fitness = " <<
+              fittest_ever->fitness << ") to: '" << outdir << "'\n";
 }
 
-void Forest::saveForest(const std::string &outdir) const {
-    for (size_t i = 0; i < population.size(); i++) {
-        auto tree = population[i];
-        tree.develop(tree.maturity);
-        tree.grow();
-
-        unsigned int width = ceil(sqrt((double) population.size()));
-        unsigned int x = i / width * 10; // TODO: make parameter
-        unsigned int z = i % width * 10;
-        for (auto &seg : tree.segments) {
-            seg.first.x += x;
-            seg.second.x += x;
-            seg.first.z += z;
-            seg.second.z += z;
-        }
+void Forest::saveForest(const std::string &outdir, unsigned int shards) {
+    if (!evaluated)
+        evaluate();
 
-        for (auto &seed : tree.seeds) {
-            seed.x += x;
-            seed.z += z;
+    size_t n_files = shards == 0 ? population.size() : std::min<size_t>(shards, population.size());
+    parallelFor(n_files, [&](size_t file) {
+        std::string segments_path, seeds_path;
+        if (shards == 0) {
+            segments_path = outdir + "/" + std::to_string(file) + "_segments.obj";
+            seeds_path = outdir + "/" + std::to_string(file) + "_seeds.obj";
+        } else {
+            std::string suffix;
+            if (n_files > 1)
+                suffix = '_' + std::to_string(file);
+            segments_path = outdir + "/forest_segments" + suffix + ".obj";
+            seeds_path = outdir + "/forest_seeds" + suffix + ".obj";
         }
+        ObjWriter segments_obj(segments_path);
+        ObjWriter seeds_obj(seeds_path);
+        size_t begin = file * population.size() / n_files;
+        size_t end = (file + 1) * population.size() / n_files;
+        for (size_t i = begin; i < end; i++) {
+            auto offset = treeOffset(i);
+            if (shards != 0) {
+                segments_obj.object("tree_" + std::to_string(i));
+                seeds_obj.object("tree_" + std::to_string(i));
+            }
+            population[i].segmentsAsOBJ(segments_obj, offset);
+            population[i].seedsAsOBJ(seeds_obj, offset);
+        }
+        segments_obj.close();
+        seeds_obj.close();
+    });
+    *log << "Saved forest to: '" << outdir << "'\n";
+}
 
-        std::ofstream file;
-        std::string basename = outdir + "/" + std::to_string(i) + "_";
-
-        file.open(basename + "segments.obj");
-        file << tree.segmentsAsOBJ();
-        file.close();
+void Forest::saveGeometry(const std::string &path) {
+    if (!evaluated)
+        evaluate();
 
-        file.open(basename + "seeds.obj");
-        file << tree.seedsAsOBJ();
-        file.close();
+    GeometryWriter writer;
+    for (size_t i = 0; i < population.size(); i++) {
+        const auto &tree = population[i];
+        writer.addTree(treeOffset(i), tree.collision_precision, tree.segments, tree.seeds);
     }
-    std::cout << "Saved forest to: '" << outdir << "'\n";
+    writer.write(path);
+    *log << "Saved forest geometry to: '" << path << "'\n";
 }
@@ -6,7 +6,19 @@
 #define L_SYSTEMS_FOREST_H
 
 #include <vector>
+#include <optional>
+#include <memory>
+#include <functional>
+#include <iostream>
 #include "tree.h"
+#include "thread_pool.h"
+#include "forest_grid.h"
+
+//! Compact record of a tree: the tree as it was before growing (so it can be grown again) and its fitness.
+struct FitnessRecord {
+    Tree tree;
+    double fitness;
+};
 
 class Forest {
 public:
@@ -24,32 +36,132 @@ public:
     //! Creates an empty forest.
     Forest() = default;
 
-    //! Evolutionary step.
+    //! Evolutionary step (the population is only evaluated if it wasn't already, e.g. by 'saveForest').
     void evolve(std::mt19937 &rng);
 
+    /*!
+     * Develops and grows every tree in the population.
+     *
+     * Clones are only evaluated once per call (if 'evaluation_cache' is set), the others copy their growth.
+     * With 'competition' set, trees then shade each other (see 'compete').
+     */
+    void evaluate();
+
+    /*!
+     * Finds the seeds of every grown tree that have a neighbouring tree above them and sets their 'shade'.
+     *
+     * All trees are put in a 'ForestGrid' (partial grids are built in parallel and then merged), so the cost grows
+     * with the total number of segments and seeds rather than with the number of pairs of trees.
+     */
+    void compete();
+
+    //! Where tree 'i' is planted (trees are laid out on a square grid 'tree_spacing' apart).
+    Pos treeOffset(size_t i) const {
+        unsigned int width = squareGridLength();
+        return {(double) (i / width) * tree_spacing, 0., (double) (i % width) * tree_spacing};
+    }
+
+    //! Copies of the 'n' fittest trees, grown as they were evaluated (the population is evaluated first if needed).
+    std::vector<Tree> fittest(size_t n);
+
+    /*!
+     * Replaces the least fit trees with 'trees', which must be grown already (e.g. taken with 'fittest').
+     *
+     * The population is evaluated first if needed, and 'trees' keep the fitness they were evaluated with.
+     */
+    void replaceLeastFit(std::vector<Tree> trees);
+
+    //! Must be called after changing 'population' by hand, so the trees are evaluated again.
+    void populationChanged() {
+        evaluated = false;
+    }
+
+    //! Gives 'other' the same settings (and thread pool) as this forest.
+    void copySettings(Forest &other) const;
+
     //! Selects a random tree from the population.
     Tree &randomTree(std::mt19937 &rng);
 
-    //! Random weighted selection of a plant based on fitness.
+    /*!
+     * Random weighted selection of a plant based on fitness.
+     *
+     * Uses the tables built by 'prepareSelection', so it must be called after it (and after any change in fitness).
+     */
     Tree &randomFitTree(std::mt19937 &rng);
 
-    //! Print some stats about the population.
+    //! Builds the lookup tables used by 'randomFitTree' and 'selectParents' (updates 'total_fitness').
+    void prepareSelection();
+
+    //! Indices of the 'n' trees chosen to reproduce according to 'selection'.
+    std::vector<size_t> selectParents(size_t n, std::mt19937 &rng);
+
+    //! Print some stats about the population (to 'log').
     void printStats();
 
     std::vector<Tree> population;
-    std::optional<Tree> fittest_ever;
-    std::optional<Tree> fittest_currently;
+    std::optional<FitnessRecord> fittest_ever;
+    //! Fittest tree of the last generation evaluated.
+    std::optional<FitnessRecord> fittest_currently;
     double total_fitness = 0;
 
+    //! Used to evaluate and mutate trees in parallel (runs serially if not set).
+    std::shared_ptr<ThreadPool> thread_pool;
+    bool evaluation_cache = true;
+    Selection selection = Selection::roulette;
+    unsigned int tournament_size = 3;
+    bool competition = false;
+    //! Fraction of the value of a seed lost when it is shaded.
+    double shading = 1.;
+    double tree_spacing = 10.;
+    double shade_cell_size = 1.;
+    unsigned long evaluation_cache_hits = 0;
+    unsigned long evaluation_cache_misses = 0;
+    //! Trees evaluated so far that ran over their budget (see 'Tree::over_budget').
+    unsigned long over_budget_trees = 0;
+    //! Where stats and the files saved are reported.
+    std::ostream *log = &std::cout;
+
     void saveFittest(const std::string &outdir);
 
     unsigned int squareGridLength() const {
         return ceil(sqrt((double) population.size()));
     }
 
-    void saveForest(const std::string &outdir) const;
+    /*!
+     * Writes the segments and seeds of every tree, placed where it is planted, to 'outdir'.
+     *
+     * The trees are split in 'shards' pairs of files ("forest_segments_<k>.obj" and "forest_seeds_<k>.obj", without
+     * the suffix if there is a single shard) with an object per tree, and shards are written in parallel.
+     * Use '0' shards to get a pair of files per tree instead. The population is evaluated first if it wasn't
+     * already, so the geometry of the last evaluation is reused instead of growing every tree again.
+     */
+    void saveForest(const std::string &outdir, unsigned int shards = 1);
+
+    //! Same as 'saveForest' but writes a single binary geometry file (see "geometry_file.h") to 'path'.
+    void saveGeometry(const std::string &path);
+
+private:
+    void parallelFor(size_t n, const std::function<void(size_t)> &func);
+
+    size_t aliasDraw(std::mt19937 &rng) const;
+
+    //! Indices of the evaluated population from the fittest to the least fit tree (ties keep their order).
+    std::vector<size_t> fitnessRanking() const;
+
+    //! Updates 'fittest_currently' and 'fittest_ever' with the evaluated population.
+    void updateFittest();
+
+    // Whether the current population was evaluated since it was germinated
+    bool evaluated = false;
+
+    // The next generation is germinated here and then swapped with 'population', so trees reuse their memory
+    std::vector<Tree> offspring;
 
-    std::string seedsAsOBJ() const;
+    // Fitness of the trees up to (and including) each index
+    std::vector<double> cumulative_fitness;
+    // Walker/Vose alias table: index 'i' is kept with probability 'alias_chance[i]', otherwise 'alias[i]' is taken
+    std::vector<double> alias_chance;
+    std::vector<size_t> alias;
 };
 
 
@@ -0,0 +1,69 @@
+#include <cmath>
+#include <algorithm>
+#include "forest_grid.h"
+
+ForestGrid::ForestGrid(double cell_size) : cell_size(cell_size) {}
+
+void ForestGrid::clear() {
+    columns.clear();
+}
+
+void ForestGrid::Column::add(size_t tree, double y) {
+    if (tree == owner) {
+        highest = std::max(highest, y);
+    } else if (y > highest) {
+        // The previous owner is now the highest of the others
+        highest_other = highest;
+        highest = y;
+        owner = tree;
+    } else {
+        highest_other = std::max(highest_other, y);
+    }
+}
+
+void ForestGrid::Column::merge(const Column &other) {
+    if (other.owner == no_tree)
+        return;
+    if (other.highest > highest) {
+        highest_other = std::max({highest, highest_other, other.highest_other});
+        highest = other.highest;
+        owner = other.owner;
+    } else {
+        highest_other = std::max({highest_other, other.highest, other.highest_other});
+    }
+}
+
+std::uint64_t ForestGrid::cell(double x, double z) const {
+    auto ix = (std::int32_t) std::floor(x / cell_size);
+    auto iz = (std::int32_t) std::floor(z / cell_size);
+    return (std::uint64_t(std::uint32_t(ix)) << 32) | std::uint32_t(iz);
+}
+
+void ForestGrid::add(size_t tree, double x, double y, double z) {
+    columns[cell(x, z)].add(tree, y);
+}
+
+void ForestGrid::addTree(size_t tree, const Pos &offset, const std::vector<std::pair<Pos, Pos>> &segments) {
+    for (const auto &[from, to] : segments) {
+        // Sample the segment at least once per cell so that long segments don't skip columns
+        double dx = to.x - from.x, dy = to.y - from.y, dz = to.z - from.z;
+        auto samples = std::max(1., std::ceil(std::sqrt(dx * dx + dz * dz) / cell_size));
+        for (double k = 0; k <= samples; k++) {
+            double t = k / samples;
+            add(tree, offset.x + from.x + t * dx, offset.y + from.y + t * dy, offset.z + from.z + t * dz);
+        }
+    }
+}
+
+void ForestGrid::merge(const ForestGrid &other) {
+    for (const auto &[key, column] : other.columns)
+        columns[key].merge(column);
+}
+
+double ForestGrid::highestOther(size_t tree, double x, double z) const {
+    auto search = columns.find(cell(x, z));
+    if (search == columns.end())
+        return nothing;
+    const auto &column = search->second;
+    return column.owner == tree ? column.highest_other : column.highest;
+}
@@ -0,0 +1,72 @@
+#ifndef L_SYSTEMS_FOREST_GRID_H
+#define L_SYSTEMS_FOREST_GRID_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include "pos.h"
+
+/*!
+ * Uniform grid of vertical columns over the whole forest, used to find out how trees shade each other.
+ *
+ * Every column remembers the highest point any tree reached in it and the highest point reached by a different
+ * tree, which is enough to answer "what is the highest point of another tree above here" in O(1) for any tree.
+ * Trees are added one at a time (in world coordinates); once built, the grid is only read, so it can be queried
+ * from many threads at once.
+ */
+class ForestGrid {
+public:
+    explicit ForestGrid(double cell_size);
+
+    //! Removes every tree (keeps the memory).
+    void clear();
+
+    //! Adds the segments of tree 'tree', displaced by 'offset'.
+    void addTree(size_t tree, const Pos &offset, const std::vector<std::pair<Pos, Pos>> &segments);
+
+    /*!
+     * Adds the trees of 'other' to this grid.
+     *
+     * The trees of both grids must be different, so that partial grids can be built separately and then merged.
+     */
+    void merge(const ForestGrid &other);
+
+    //! Highest point of a tree other than 'tree' in the column at ('x', 'z') (or -infinity if there is none).
+    double highestOther(size_t tree, double x, double z) const;
+
+    //! Whether a tree other than 'tree' reaches above 'pos' (which is relative to 'offset').
+    bool shaded(size_t tree, const Pos &offset, const Pos &pos) const {
+        return highestOther(tree, pos.x + offset.x, pos.z + offset.z) > pos.y + offset.y;
+    }
+
+    //! Number of columns something grew in.
+    size_t occupiedCells() const {
+        return columns.size();
+    }
+
+    double cell_size;
+
+private:
+    static constexpr double nothing = -std::numeric_limits<double>::infinity();
+    static constexpr size_t no_tree = std::numeric_limits<size_t>::max();
+
+    struct Column {
+        double highest = nothing;
+        size_t owner = no_tree;
+        // Highest point of any tree other than 'owner'
+        double highest_other = nothing;
+
+        void add(size_t tree, double y);
+
+        void merge(const Column &other);
+    };
+
+    std::uint64_t cell(double x, double z) const;
+
+    void add(size_t tree, double x, double y, double z);
+
+    std::unordered_map<std::uint64_t, Column> columns;
+};
+
+#endif //L_SYSTEMS_FOREST_GRID_H
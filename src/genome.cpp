@@ -4,6 +4,7 @@
 
 #include <stdexcept>
 #include <sstream>
+#include <iomanip>
 #include "genome.h"
 #include "utility.h"
 
@@ -22,81 +23,174 @@ Genome::Genome(
     gene_activation_length(gene_activation_length) {
     if (size > max_size)
         throw std::runtime_error("Max 'size' is " + std::to_string(max_size));
+    // Duplications can at most double the genome before 'max_size' is enforced
+    if (2 * max_size > dead_gene - n_core_genes)
+        throw std::runtime_error("Max 'max_size' is " + std::to_string((dead_gene - n_core_genes) / 2));
+    if (size == 0 || gene_activation_length == 0)
+        throw std::runtime_error("'size' and 'gene_activation_length' must be positive");
 
+    rules.reserve(size * gene_activation_length);
+    genes.reserve(size);
     for (unsigned int i = 0; i < size; i++)
-        activation_map[geneIdToGeneString(used_genes++)] = {};
-    for (auto &gene : activation_map) {
-        for (unsigned int _ = 0; _ < gene_activation_length; _++)
-            gene.second.push_back(getRandomGene(rng));
+        newGene();
+    for (auto gene : genes) {
+        for (unsigned int j = 0; j < gene_activation_length; j++)
+            rule(gene)[j] = getRandomGene(rng);
     }
 }
 
-void Genome::mutDup(std::mt19937 &rng) {
+Gene Genome::newGene() {
+    Gene gene = no_gene;
+    for (unsigned int c = 0; c < used_genes; c++) {  // Recycles deleted genes
+        if (rules[c * gene_activation_length] == dead_gene) {
+            gene = growthGene(c);
+            break;
+        }
+    }
+    if (gene == no_gene) {
+        gene = growthGene(used_genes++);
+        rules.resize(used_genes * gene_activation_length);
+    }
+    std::fill_n(rule(gene), gene_activation_length, no_gene);
+    genes.push_back(gene);
+    return gene;
+}
+
+template<class Rng>
+void Genome::mutate(Rng &rng) {
+    mutSub(rng);
+    mutDel(rng);
+    mutDup(rng);
+}
+
+template void Genome::mutate(std::mt19937 &rng);
+
+template void Genome::mutate(SplitMix64 &rng);
+
+template<class Rng>
+void Genome::mutDup(Rng &rng) {
     if (size() >= max_size)
         return;
 
-    ActivationMap to_add;
-    for (auto &gene : activation_map) {
+    // Genes added here are not considered for duplication in the same call
+    for (size_t i = 0, n = genes.size(); i < n; i++) {
         if (uniform_random(rng) > mut_dup)
             continue;
 
-        std::string new_gene;
-        for (unsigned int c = 0; c < used_genes; c++) {  //Recycles deleted genes (inefficient implementation)
-            auto s = geneIdToGeneString(c);
-            if (activation_map.find(s) == activation_map.end()) {
-                new_gene = s;
-                break;
-            }
-        }
-        if (new_gene.empty())
-            new_gene = geneIdToGeneString(used_genes++);
-        to_add.insert({new_gene, gene.second});
-    }
-
-    for (auto &gene : to_add) {
-        activation_map.insert(gene);
+        Gene gene = genes[i];
+        Gene new_gene = newGene();
+        std::copy_n(rule(gene), gene_activation_length, rule(new_gene));
     }
 }
 
 //TODO: change so that sub_rate is applied per target gene
-void Genome::mutSub(std::mt19937 &rng) {
-    for (auto &gene : activation_map) {
+template<class Rng>
+void Genome::mutSub(Rng &rng) {
+    for (auto gene : genes) {
         if (uniform_random(rng) > mut_sub)
             continue;
 
-        std::string sub_gene;
+        Gene sub_gene;
         if (uniform_random(rng) < core_gene_substitution_chance) {
-            std::uniform_int_distribution<> uniform_dir(0, core_genes.size() - 1);
-            sub_gene = core_genes[uniform_dir(rng)];
+            std::uniform_int_distribution<> uniform_dir(0, n_core_genes - 1);
+            sub_gene = Gene(uniform_dir(rng));
         } else {
             sub_gene = getRandomGene(rng);
         }
 
-        gene.second.at(int(uniform_random(rng) * gene_activation_length)) = sub_gene;
+        rule(gene)[int(uniform_random(rng) * gene_activation_length)] = sub_gene;
     }
 }
 
-void Genome::mutDel(std::mt19937 &rng) {
-    if (activation_map.size() == 1)
+template<class Rng>
+void Genome::mutDel(Rng &rng) {
+    if (genes.size() == 1)
         return;
 
-    std::vector<std::string> to_remove;
-    for (auto &gene : activation_map) {
+    std::vector<bool> removed(geneIdBound(), false);
+    size_t n_removed = 0;
+    for (auto gene : genes) {
+        // Always keep at least one gene alive
+        if (n_removed == genes.size() - 1)
+            break;
         if (uniform_random(rng) > mut_del)
             continue;
 
-        to_remove.push_back(gene.first);
+        removed[gene] = true;
+        n_removed++;
+    }
+    if (n_removed == 0)
+        return;
+
+    for (auto &target_gene : rules) {
+        if (target_gene < removed.size() && removed[target_gene])
+            target_gene = no_gene;
+    }
+    for (auto gene : genes) {
+        if (removed[gene])
+            rule(gene)[0] = dead_gene;
+    }
+    std::erase_if(genes, [&removed](Gene gene) { return removed[gene]; });
+}
 
-        for (auto &gene2 : activation_map) {
-            for (auto &target_gene : gene2.second) {
-                if (target_gene == gene.first)
-                    target_gene = "";
+std::pmr::vector<std::uint64_t> Genome::expansionLengths(
+    unsigned int stages,
+    std::pmr::memory_resource *resource
+) const {
+    constexpr auto max_length = std::numeric_limits<std::uint64_t>::max();
+    size_t n_genes = geneIdBound();
+    std::pmr::vector<std::uint64_t> lengths((stages + 1) * n_genes, 1, resource);
+    for (unsigned int k = 1; k <= stages; k++) {
+        const auto *prev = lengths.data() + (k - 1) * n_genes;
+        auto *cur = lengths.data() + k * n_genes;
+        for (Gene gene = n_core_genes; gene < n_genes; gene++) {
+            auto targets = geneActivates(gene);
+            if (targets.empty())
+                continue;
+            std::uint64_t length = 0;
+            for (auto target : targets) {
+                if (target == no_gene)
+                    continue;
+                auto target_length = target < n_genes ? prev[target] : 1;
+                length = target_length > max_length - length ? max_length : length + target_length;
             }
+            cur[gene] = length;
         }
     }
+    return lengths;
+}
 
-    for (auto &gene : to_remove)
-        activation_map.erase(gene);
+std::pmr::vector<BranchBalance> Genome::branchBalances(
+    unsigned int stages,
+    std::pmr::memory_resource *resource
+) const {
+    static constexpr std::int64_t max_balance = std::int64_t(1) << 62;
+    auto clamp = [](std::int64_t value) { return std::clamp(value, -max_balance, max_balance); };
+
+    size_t n_genes = geneIdBound();
+    std::pmr::vector<BranchBalance> balances((stages + 1) * n_genes, resource);
+    balances[branch_open] = {1, 0};
+    balances[branch_close] = {-1, -1};
+    for (unsigned int k = 1; k <= stages; k++) {
+        const auto *prev = balances.data() + (k - 1) * n_genes;
+        auto *cur = balances.data() + k * n_genes;
+        for (Gene gene = 0; gene < n_genes; gene++) {
+            auto targets = geneActivates(gene);
+            if (targets.empty()) {
+                cur[gene] = prev[gene];
+                continue;
+            }
+            BranchBalance balance;
+            for (auto target : targets) {
+                if (target == no_gene || target >= n_genes)
+                    continue;
+                balance.lowest = std::min(balance.lowest, clamp(balance.net + prev[target].lowest));
+                balance.net = clamp(balance.net + prev[target].net);
+            }
+            cur[gene] = balance;
+        }
+    }
+    return balances;
 }
 
 std::string Genome::geneIdToGeneString(unsigned int i) {
@@ -114,26 +208,76 @@ std::string Genome::geneIdToGeneString(unsigned int i) {
     return buffer;
 }
 
-const std::string &Genome::getRandomGene(std::mt19937 &rng) const {
-    std::uniform_int_distribution<> uniform_genome(0, (int) activation_map.size() - 1);
-    return std::next(std::begin(activation_map), uniform_genome(rng))->first;
-}
-
 std::string Genome::stringRepresentation() const {
     std::stringstream gen_ss;
-    for (auto &gene : activation_map) {
-        gen_ss << gene.first << " -> ";
+    for (Gene gene = n_core_genes; gene < geneIdBound(); gene++) {
+        auto targets = geneActivates(gene);
+        if (targets.empty())
+            continue;
+        gen_ss << geneToString(gene) << " -> ";
         for (unsigned int i = 0; i < gene_activation_length - 1; i++)
-            gen_ss << gene.second.at(i) << " | ";
-        gen_ss << gene.second.at(gene_activation_length - 1);
+            gen_ss << geneToString(targets[i]) << " | ";
+        gen_ss << geneToString(targets[gene_activation_length - 1]);
         gen_ss << "\n";
     }
     return gen_ss.str();
 }
 
-std::string Genome::translateGene(const std::string &gene) {
+void Genome::save(std::ostream &out) const {
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    out << max_size << " " << mut_sub << " " << mut_dup << " " << mut_del << " " << gene_activation_length << " "
+        << core_gene_substitution_chance << " " << used_genes << "\n";
+    writeVector(out, rules);
+    writeVector(out, genes);
+}
+
+Genome Genome::load(std::istream &in) {
+    Genome genome;
+    in >> genome.max_size >> genome.mut_sub >> genome.mut_dup >> genome.mut_del >> genome.gene_activation_length
+       >> genome.core_gene_substitution_chance >> genome.used_genes;
+    if (!in)
+        throw std::runtime_error("Could not read genome");
+    readVector(in, genome.rules);
+    readVector(in, genome.genes);
+    if (genome.gene_activation_length == 0 || genome.rules.size() != genome.used_genes * genome.gene_activation_length)
+        throw std::runtime_error("Genome rules don't match its number of genes");
+    // Gene ids index the rule table, so a corrupted genome must not get any further
+    if (genome.geneIdBound() > dead_gene)
+        throw std::runtime_error("Genome has too many genes");
+    for (unsigned int i = 0; i < genome.used_genes; i++) {
+        const auto *targets = genome.rules.data() + i * genome.gene_activation_length;
+        if (targets[0] == dead_gene)
+            continue;
+        for (unsigned int j = 0; j < genome.gene_activation_length; j++) {
+            if (targets[j] != no_gene && targets[j] >= genome.geneIdBound())
+                throw std::runtime_error("Genome rule refers to unknown gene " + std::to_string(targets[j]));
+        }
+    }
+    for (auto gene : genome.genes) {
+        if (!isGrowthGene(gene) || gene >= genome.geneIdBound() || genome.geneActivates(gene).empty())
+            throw std::runtime_error("Genome lists unknown gene " + std::to_string(gene));
+    }
+    return genome;
+}
+
+std::size_t Genome::rulesHash() const {
+    std::size_t hash = rules.size();
+    for (auto gene : rules)
+        hashCombine(hash, gene);
+    return hash;
+}
+
+std::string Genome::translateGene(Gene gene) {
     if (isGrowthGene(gene)) {
         return "F";
     }
-    return gene;
+    return core_genes[gene];
+}
+
+std::string Genome::geneToString(Gene gene) {
+    if (gene == no_gene)
+        return "";
+    if (isGrowthGene(gene))
+        return geneIdToGeneString(gene - n_core_genes);
+    return core_genes[gene];
 }
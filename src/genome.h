@@ -5,73 +5,167 @@
 #ifndef L_SYSTEMS_GENOME_H
 #define L_SYSTEMS_GENOME_H
 
-#include <unordered_map>
 #include <string>
 #include <vector>
 #include <array>
 #include <algorithm>
 #include <memory>
+#include <memory_resource>
 #include <random>
+#include <span>
+#include <cstdint>
+#include <limits>
 #include "parameters.h"
 
-using ActivationMap = std::unordered_map<std::string, std::vector<std::string>>;
+//! Genes are interned as small integers: core genes come first, growth genes follow.
+using Gene = std::uint16_t;
+
+//! How the branches opened and closed by the expansion of a gene nest.
+struct BranchBalance {
+    //! Branches opened minus branches closed.
+    std::int64_t net = 0;
+    //! Lowest value 'net' takes while reading the expansion from left to right (never positive).
+    std::int64_t lowest = 0;
+
+    //! Whether every branch closed by the expansion was also opened by it.
+    bool selfContained() const {
+        return lowest == 0;
+    }
+};
 
 class Genome {
 public:
+    //! Order must match 'core_genes'.
+    enum CoreGene : Gene {
+        x_pos,
+        x_neg,
+        y_pos,
+        y_neg,
+        seed,
+        branch_open,
+        branch_close,
+        n_core_genes
+    };
+
+    //! Used as a target when the gene it pointed to was deleted.
+    static constexpr Gene no_gene = std::numeric_limits<Gene>::max();
+
+    //! Marks the first slot of the rule of a deleted gene.
+    static constexpr Gene dead_gene = no_gene - 1;
+
     //! Creates a randomized genome of size 'size'.
     Genome(unsigned int size, unsigned int max_size, double mut_sub, double mut_dup, double mut_del,
            unsigned int gene_activation_length, std::mt19937 &rng);
 
     size_t size() const {
-        return activation_map.size();
+        return genes.size();
     }
 
-    const std::string &getRandomGene(std::mt19937 &rng) const;
+    template<class Rng>
+    Gene getRandomGene(Rng &rng) const {
+        std::uniform_int_distribution<> uniform_genome(0, (int) genes.size() - 1);
+        return genes[uniform_genome(rng)];
+    }
 
-    //! Forgive me, gods, for I have used pointers (there is no std::optional(&T) though, so not my fault)
-    const std::vector<std::string> *geneActivates(const std::string &gene) const {
-        auto search = activation_map.find(gene);
-        if (search == activation_map.end())
-            return nullptr;
-        return &search->second;
+    //! Genes activated by 'gene' (empty if 'gene' is a core gene or was deleted).
+    std::span<const Gene> geneActivates(Gene gene) const {
+        size_t i = gene - n_core_genes;
+        if (gene < n_core_genes || i >= used_genes || rules[i * gene_activation_length] == dead_gene)
+            return {};
+        return {rules.data() + i * gene_activation_length, gene_activation_length};
     }
 
-    void mutate(std::mt19937 &rng) {
-        mutSub(rng);
-        mutDel(rng);
-        mutDup(rng);
+    //! One past the highest gene id in use, so tables indexed by gene can be sized with it.
+    size_t geneIdBound() const {
+        return n_core_genes + used_genes;
     }
 
+    /*!
+     * Number of symbols each gene expands into after 0 to 'stages' development stages.
+     *
+     * The length of 'gene' after 'k' stages is at index 'k * geneIdBound() + gene'. Lengths saturate at the
+     * maximum value of 'uint64_t' instead of overflowing, so runaway genomes can be detected before developing them.
+     */
+    std::pmr::vector<std::uint64_t> expansionLengths(
+        unsigned int stages,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+    ) const;
+
+    //! Same as 'expansionLengths' but for the branches opened and closed by each gene (values are clamped).
+    std::pmr::vector<BranchBalance> branchBalances(
+        unsigned int stages,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+    ) const;
+
+    //! Available for 'std::mt19937' and 'SplitMix64' (see the instantiations in "genome.cpp").
+    template<class Rng>
+    void mutate(Rng &rng);
+
     std::string stringRepresentation() const;
 
-    //! Returns the gene back if its a core gene and "F" otherwise.
-    static std::string translateGene(const std::string &gene);
+    //! Writes everything needed to restore the genome exactly (including the order of its genes) to 'out'.
+    void save(std::ostream &out) const;
+
+    //! Reads a genome written by 'save'.
+    static Genome load(std::istream &in);
 
-    static bool isGrowthGene(const std::string &gene) {
-        return std::find(core_genes.begin(), core_genes.end(), gene) == core_genes.end();
+    //! Whether both genomes develop genes in the exact same way.
+    bool sameRules(const Genome &other) const {
+        return rules == other.rules;
+    }
+
+    std::size_t rulesHash() const;
+
+    //! Returns the name of the gene back if its a core gene and "F" otherwise.
+    static std::string translateGene(Gene gene);
+
+    //! Name of the gene as used in the output files.
+    static std::string geneToString(Gene gene);
+
+    static bool isGrowthGene(Gene gene) {
+        return gene >= n_core_genes;
     }
 
     unsigned int max_size;
     double mut_sub;
     double mut_dup;
     double mut_del;
+    //! Stride of the rule table, must not change after construction.
     unsigned int gene_activation_length;
 
     double core_gene_substitution_chance = 0.5;
-    //TODO: should this be an unordered_set? benchmark
     static constexpr std::array core_genes = {"x+", "x-", "y+", "y-", "*", "[", "]"};
 
 private:
-    void mutDup(std::mt19937 &rng);
+    Genome() = default;
 
-    void mutSub(std::mt19937 &rng);
+    template<class Rng>
+    void mutDup(Rng &rng);
 
-    void mutDel(std::mt19937 &rng);
+    template<class Rng>
+    void mutSub(Rng &rng);
+
+    template<class Rng>
+    void mutDel(Rng &rng);
 
     static std::string geneIdToGeneString(unsigned int i);
 
+    static Gene growthGene(unsigned int i) {
+        return Gene(n_core_genes + i);
+    }
+
+    Gene *rule(Gene gene) {
+        return rules.data() + (gene - n_core_genes) * gene_activation_length;
+    }
+
+    //! Appends a rule slot for a new gene (or reuses a deleted one) and returns the gene.
+    Gene newGene();
+
     unsigned int used_genes = 0;
-    ActivationMap activation_map;
+    //! Rules of gene 'n_core_genes + i' are stored at [i * gene_activation_length, (i + 1) * gene_activation_length).
+    std::vector<Gene> rules;
+    //! Genes currently alive in the genome (allows O(1) random selection).
+    std::vector<Gene> genes;
 };
 
 
@@ -0,0 +1,120 @@
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "geometry_file.h"
+
+static CollisionPos quantize(const Pos &pos, unsigned int collision_precision) {
+    return {
+        (int) std::lround(pos.x * collision_precision),
+        (int) std::lround(pos.y * collision_precision),
+        (int) std::lround(pos.z * collision_precision)
+    };
+}
+
+void GeometryWriter::addTree(
+    const Pos &offset,
+    unsigned int collision_precision,
+    const std::vector<std::pair<Pos, Pos>> &tree_segments,
+    const std::vector<Pos> &tree_seeds
+) {
+    entries.push_back({
+        {offset.x, offset.y, offset.z},
+        segments.size(),
+        tree_segments.size(),
+        seeds.size(),
+        tree_seeds.size(),
+        collision_precision,
+        0
+    });
+    for (const auto &[from, to] : tree_segments)
+        segments.push_back({quantize(from, collision_precision), quantize(to, collision_precision)});
+    for (const auto &seed : tree_seeds)
+        seeds.push_back(quantize(seed, collision_precision));
+}
+
+void GeometryWriter::write(const std::string &path) const {
+    GeometryHeader header = {{}, GeometryHeader::current_version, 0, entries.size(), segments.size(), seeds.size()};
+    std::memcpy(header.magic, GeometryHeader::expected_magic, sizeof(header.magic));
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(entries.data()), (std::streamsize) (entries.size() * sizeof(GeometryTreeEntry)));
+    file.write(reinterpret_cast<const char *>(segments.data()), (std::streamsize) (segments.size() * sizeof(GeometrySegment)));
+    file.write(reinterpret_cast<const char *>(seeds.data()), (std::streamsize) (seeds.size() * sizeof(CollisionPos)));
+    file.close();
+    if (!file)
+        throw std::runtime_error("Could not write '" + path + "'");
+}
+
+GeometryFile::GeometryFile(const std::string &path) : path(path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open '" + path + "': " + std::strerror(errno));
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not stat '" + path + "': " + std::strerror(errno));
+    }
+    size = info.st_size;
+    if (size < sizeof(GeometryHeader)) {
+        ::close(fd);
+        throw std::runtime_error("'" + path + "' is not a geometry file");
+    }
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        throw std::runtime_error("Could not map '" + path + "': " + std::strerror(errno));
+    data = static_cast<const std::byte *>(map);
+
+    header = reinterpret_cast<const GeometryHeader *>(data);
+    auto fail = [this](const std::string &reason) {
+        ::munmap(const_cast<std::byte *>(data), size);
+        throw std::runtime_error("'" + this->path + "' " + reason);
+    };
+    if (std::memcmp(header->magic, GeometryHeader::expected_magic, sizeof(header->magic)) != 0)
+        fail("is not a geometry file");
+    if (header->version != GeometryHeader::current_version)
+        fail("has unsupported version " + std::to_string(header->version));
+
+    // Sizes are checked one section at a time so that they can't overflow
+    size_t offset = sizeof(GeometryHeader);
+    auto section = [&](std::uint64_t count, size_t element_size) {
+        if (count > (size - offset) / element_size)
+            fail("is truncated");
+        auto begin = data + offset;
+        offset += count * element_size;
+        return begin;
+    };
+    entries = reinterpret_cast<const GeometryTreeEntry *>(section(header->n_trees, sizeof(GeometryTreeEntry)));
+    segments = reinterpret_cast<const GeometrySegment *>(section(header->n_segments, sizeof(GeometrySegment)));
+    seeds = reinterpret_cast<const CollisionPos *>(section(header->n_seeds, sizeof(CollisionPos)));
+    for (size_t i = 0; i < header->n_trees; i++) {
+        const auto &entry = entries[i];
+        if (entry.first_segment > header->n_segments || entry.n_segments > header->n_segments - entry.first_segment ||
+            entry.first_seed > header->n_seeds || entry.n_seeds > header->n_seeds - entry.first_seed ||
+            entry.collision_precision == 0)
+            fail("has an invalid entry for tree " + std::to_string(i));
+    }
+}
+
+GeometryFile::~GeometryFile() {
+    ::munmap(const_cast<std::byte *>(data), size);
+}
+
+GeometryFile::TreeView GeometryFile::tree(size_t i) const {
+    if (i >= header->n_trees)
+        throw std::out_of_range("Tree " + std::to_string(i) + " is not in '" + path + "'");
+    const auto &entry = entries[i];
+    return {
+        {entry.offset[0], entry.offset[1], entry.offset[2]},
+        entry.collision_precision,
+        {segments + entry.first_segment, entry.n_segments},
+        {seeds + entry.first_seed, entry.n_seeds}
+    };
+}
@@ -0,0 +1,118 @@
+#ifndef L_SYSTEMS_GEOMETRY_FILE_H
+#define L_SYSTEMS_GEOMETRY_FILE_H
+
+#include <string>
+#include <vector>
+#include <span>
+#include <cstdint>
+#include <bit>
+#include "pos.h"
+
+/*
+ * Binary geometry format
+ * ======================
+ * All values are little-endian and every section is aligned to its element:
+ *
+ *   GeometryHeader
+ *   GeometryTreeEntry[n_trees]
+ *   GeometrySegment[n_segments]  (segments of every tree, one tree after the other)
+ *   CollisionPos[n_seeds]        (seeds of every tree, one tree after the other)
+ *
+ * Positions are stored as integers relative to the tree, exactly as the turtle computed them. The real position
+ * of a vertex is 'offset + pos / collision_precision'.
+ */
+
+struct GeometryHeader {
+    static constexpr char expected_magic[8] = {'L', 'S', 'Y', 'S', 'G', 'E', 'O', '\0'};
+    static constexpr std::uint32_t current_version = 1;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t n_trees;
+    std::uint64_t n_segments;
+    std::uint64_t n_seeds;
+};
+
+struct GeometryTreeEntry {
+    double offset[3];
+    std::uint64_t first_segment;
+    std::uint64_t n_segments;
+    std::uint64_t first_seed;
+    std::uint64_t n_seeds;
+    std::uint32_t collision_precision;
+    std::uint32_t reserved;
+};
+
+struct GeometrySegment {
+    CollisionPos from;
+    CollisionPos to;
+};
+
+static_assert(std::endian::native == std::endian::little, "Geometry files are read and written in place");
+static_assert(sizeof(GeometryHeader) == 40 && sizeof(GeometryTreeEntry) == 64 && sizeof(GeometrySegment) == 24);
+
+//! Collects trees and writes them in the binary geometry format.
+class GeometryWriter {
+public:
+    //! Adds a tree planted at 'offset' (its geometry is quantized right away).
+    void addTree(
+        const Pos &offset,
+        unsigned int collision_precision,
+        const std::vector<std::pair<Pos, Pos>> &segments,
+        const std::vector<Pos> &seeds
+    );
+
+    void write(const std::string &path) const;
+
+private:
+    std::vector<GeometryTreeEntry> entries;
+    std::vector<GeometrySegment> segments;
+    std::vector<CollisionPos> seeds;
+};
+
+/*!
+ * Read-only view of a geometry file.
+ *
+ * The file is memory-mapped and validated once, then trees are accessed in place without copying anything.
+ */
+class GeometryFile {
+public:
+    explicit GeometryFile(const std::string &path);
+
+    ~GeometryFile();
+
+    GeometryFile(const GeometryFile &) = delete;
+
+    GeometryFile &operator=(const GeometryFile &) = delete;
+
+    struct TreeView {
+        Pos offset;
+        unsigned int collision_precision;
+        std::span<const GeometrySegment> segments;
+        std::span<const CollisionPos> seeds;
+
+        //! Real position of 'pos' (one of the positions of this tree).
+        Pos position(const CollisionPos &pos) const {
+            Pos real(pos, collision_precision);
+            return {real.x + offset.x, real.y + offset.y, real.z + offset.z};
+        }
+    };
+
+    size_t trees() const {
+        return header->n_trees;
+    }
+
+    TreeView tree(size_t i) const;
+
+private:
+    std::string path;
+    const std::byte *data = nullptr;
+    size_t size = 0;
+    const GeometryHeader *header = nullptr;
+    const GeometryTreeEntry *entries = nullptr;
+    const GeometrySegment *segments = nullptr;
+    const CollisionPos *seeds = nullptr;
+};
+
+#endif //L_SYSTEMS_GEOMETRY_FILE_H
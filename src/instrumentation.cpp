@@ -0,0 +1,179 @@
+#include <atomic>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include "instrumentation.h"
+
+struct alignas(64) Slot {
+    std::array<std::atomic<std::uint64_t>, Instrumentation::n_phases> nanoseconds;
+    std::array<std::atomic<std::uint64_t>, Instrumentation::n_counters> counts;
+    std::atomic<std::uint64_t> peak_body_length;
+};
+
+// Every running thread gets a slot of its own, except that threads beyond the first 'n_slots - 1' share the last one
+static constexpr size_t n_slots = 256;
+static constexpr size_t shared_slot = n_slots - 1;
+// Constant-initialized, so they can be used by 'operator new' before 'main'
+static Slot slots[n_slots];
+static std::atomic<bool> slot_taken[shared_slot];
+// Plain pointer so that taking the slot never allocates (it is used by 'operator new')
+static thread_local Slot *thread_slot = nullptr;
+
+// Gives the slot of a thread back when it exits, so that the threads started later (islands, checkpoint writers,
+// batch drivers...) reuse it instead of ending up in the shared slot. What the slot counted stays in it
+struct SlotOwner {
+    size_t index = shared_slot;
+
+    ~SlotOwner() {
+        if (index == shared_slot)
+            return;
+        // Whatever is counted during the rest of the exit goes to the shared slot
+        thread_slot = &slots[shared_slot];
+        slot_taken[index].store(false, std::memory_order_release);
+    }
+};
+
+static thread_local SlotOwner slot_owner;
+
+static Slot &threadSlot() {
+    if (thread_slot == nullptr) {
+        thread_slot = &slots[shared_slot];
+        for (size_t i = 0; i < shared_slot; i++) {
+            if (!slot_taken[i].load(std::memory_order_relaxed) &&
+                !slot_taken[i].exchange(true, std::memory_order_acquire)) {
+                thread_slot = &slots[i];
+                slot_owner.index = i;
+                break;
+            }
+        }
+    }
+    return *thread_slot;
+}
+
+// Only the owner of a slot writes to it, so a plain load and store is enough (and much cheaper than 'fetch_add'),
+// other threads only ever read it
+static void add(Slot &slot, std::atomic<std::uint64_t> &value, std::uint64_t n) {
+    if (&slot == &slots[shared_slot])
+        value.fetch_add(n, std::memory_order_relaxed);
+    else
+        value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Instrumentation::addTime(Phase phase, std::uint64_t nanoseconds) {
+    auto &slot = threadSlot();
+    add(slot, slot.nanoseconds[phase], nanoseconds);
+}
+
+void Instrumentation::count(Counter counter, std::uint64_t n) {
+    auto &slot = threadSlot();
+    add(slot, slot.counts[counter], n);
+}
+
+void Instrumentation::bodyLength(std::uint64_t length) {
+    auto &peak = threadSlot().peak_body_length;
+    auto current = peak.load(std::memory_order_relaxed);
+    while (length > current && !peak.compare_exchange_weak(current, length, std::memory_order_relaxed)) {}
+}
+
+Instrumentation::Totals Instrumentation::totals() {
+    Totals totals;
+    for (const auto &slot : slots) {
+        for (size_t i = 0; i < n_phases; i++)
+            totals.nanoseconds[i] += slot.nanoseconds[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n_counters; i++)
+            totals.counts[i] += slot.counts[i].load(std::memory_order_relaxed);
+        totals.peak_body_length = std::max(totals.peak_body_length,
+                                           slot.peak_body_length.load(std::memory_order_relaxed));
+    }
+    return totals;
+}
+
+void Instrumentation::resetPeakBodyLength() {
+    for (auto &slot : slots)
+        slot.peak_body_length.store(0, std::memory_order_relaxed);
+}
+
+const char *Instrumentation::name(Phase phase) {
+    static constexpr std::array<const char *, n_phases> names = {
+        "evaluate", "develop", "grow", "mutate", "fitness", "selection", "germination", "save"
+    };
+    return names[phase];
+}
+
+const char *Instrumentation::name(Counter counter) {
+    static constexpr std::array<const char *, n_counters> names = {
+        "genes_developed", "genes_grown", "segments", "allocations", "allocated_bytes"
+    };
+    return names[counter];
+}
+
+InstrumentationLog::InstrumentationLog(const std::string &path, bool append) :
+    file(path, append ? std::ios::app : std::ios::trunc) {
+    if (!file)
+        throw std::runtime_error("Could not open '" + path + "'");
+    if (file.tellp() == 0) {
+        file << "generation,generations,wall_ms";
+        for (size_t i = 0; i < Instrumentation::n_phases; i++)
+            file << "," << Instrumentation::name(Instrumentation::Phase(i)) << "_ms";
+        file << ",genes_per_second,peak_body_length";
+        for (size_t i = 0; i < Instrumentation::n_counters; i++)
+            file << "," << Instrumentation::name(Instrumentation::Counter(i));
+        file << "\n";
+    }
+    restart();
+}
+
+void InstrumentationLog::restart() {
+    last = Instrumentation::totals();
+    Instrumentation::resetPeakBodyLength();
+    last_time = std::chrono::steady_clock::now();
+}
+
+void InstrumentationLog::record(unsigned int generation, unsigned int generations) {
+    auto now = std::chrono::steady_clock::now();
+    auto totals = Instrumentation::totals();
+    std::chrono::duration<double> wall = now - last_time;
+
+    auto counted = [this, &totals](Instrumentation::Counter counter) {
+        return totals.counts[counter] - last.counts[counter];
+    };
+    auto genes = counted(Instrumentation::genes_developed) + counted(Instrumentation::genes_grown);
+    file << generation << "," << generations << "," << wall.count() * 1e3;
+    for (size_t i = 0; i < Instrumentation::n_phases; i++)
+        file << "," << (double) (totals.nanoseconds[i] - last.nanoseconds[i]) * 1e-6;
+    file << "," << (wall.count() > 0 ? (double) genes / wall.count() : 0.) << "," << totals.peak_body_length;
+    for (size_t i = 0; i < Instrumentation::n_counters; i++)
+        file << "," << counted(Instrumentation::Counter(i));
+    file << "\n";
+
+    last = totals;
+    Instrumentation::resetPeakBodyLength();
+    last_time = now;
+}
+
+#ifdef L_SYSTEMS_INSTRUMENTATION
+// Counts every allocation made through the global 'operator new' (the array and nothrow versions call this one)
+void *operator new(std::size_t size) {
+    Instrumentation::count(Instrumentation::allocations, 1);
+    Instrumentation::count(Instrumentation::allocated_bytes, size);
+    if (size == 0)
+        size = 1;
+    while (true) {
+        if (void *pointer = std::malloc(size))
+            return pointer;
+        auto handler = std::get_new_handler();
+        if (handler == nullptr)
+            throw std::bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    std::free(pointer);
+}
+#endif
@@ -0,0 +1,133 @@
+#ifndef L_SYSTEMS_INSTRUMENTATION_H
+#define L_SYSTEMS_INSTRUMENTATION_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+/*!
+ * Process-wide timers and counters of where the model spends its time.
+ *
+ * Recorded through the 'INSTRUMENT_*' macros below, which expand to nothing unless 'L_SYSTEMS_INSTRUMENTATION' is
+ * defined (see the option in CMakeLists.txt). Every thread adds to its own slot (given back when the thread exits),
+ * so recording costs a relaxed atomic load and store, and 'totals' adds the slots up. Threads beyond the number of
+ * slots share the last one, which is updated with atomic additions.
+ *
+ * Phases nest (growing happens inside evaluation) and the time of a phase running on several threads at once is
+ * added up over the threads, so phase times can exceed the wall time. Models running at the same time in one
+ * process (see 'runBatch') share the counters.
+ */
+class Instrumentation {
+public:
+    enum Phase {
+        evaluate,
+        develop,
+        grow,
+        mutate,
+        fitness,  // Summing up fitness and keeping the records of the fittest trees
+        selection,
+        germination,
+        save,
+        n_phases
+    };
+
+    enum Counter {
+        genes_developed,  // Genes written while developing bodies
+        genes_grown,  // Genes interpreted by the turtle (replayed fragments not included)
+        segments,
+        allocations,  // Calls to the global 'operator new'
+        allocated_bytes,
+        n_counters
+    };
+
+    struct Totals {
+        std::array<std::uint64_t, n_phases> nanoseconds{};
+        std::array<std::uint64_t, n_counters> counts{};
+        //! Longest body grown since the last 'resetPeakBodyLength'.
+        std::uint64_t peak_body_length = 0;
+    };
+
+#ifdef L_SYSTEMS_INSTRUMENTATION
+    static constexpr bool enabled = true;
+#else
+    static constexpr bool enabled = false;
+#endif
+
+    static void addTime(Phase phase, std::uint64_t nanoseconds);
+
+    static void count(Counter counter, std::uint64_t n);
+
+    static void bodyLength(std::uint64_t length);
+
+    static Totals totals();
+
+    static void resetPeakBodyLength();
+
+    static const char *name(Phase phase);
+
+    static const char *name(Counter counter);
+
+    //! Adds the time from its construction to its destruction to 'phase'.
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Phase phase) : phase(phase), start(std::chrono::steady_clock::now()) {}
+
+        ~ScopedTimer() {
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+            addTime(phase, elapsed.count());
+        }
+
+        ScopedTimer(const ScopedTimer &) = delete;
+
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    private:
+        Phase phase;
+        std::chrono::steady_clock::time_point start;
+    };
+};
+
+/*!
+ * Time series of the totals, written as CSV (one row per call to 'record').
+ *
+ * Each row holds what happened since the previous one: per-phase times in milliseconds, genes developed and grown
+ * (and how many per second of wall time), the longest body, segments and allocations.
+ */
+class InstrumentationLog {
+public:
+    //! Writes the header unless appending to an existing file.
+    InstrumentationLog(const std::string &path, bool append);
+
+    //! Starts the next row from now (what happened since the last row is left out).
+    void restart();
+
+    /*!
+     * Writes a row for the 'generations' generations evolved until 'generation'.
+     *
+     * 'generations' is 0 for rows of work other than evolving (e.g. saving the results).
+     */
+    void record(unsigned int generation, unsigned int generations);
+
+private:
+    std::ofstream file;
+    Instrumentation::Totals last;
+    std::chrono::steady_clock::time_point last_time;
+};
+
+#ifdef L_SYSTEMS_INSTRUMENTATION
+#define INSTRUMENT_CONCAT_(a, b) a##b
+#define INSTRUMENT_CONCAT(a, b) INSTRUMENT_CONCAT_(a, b)
+//! Times the rest of the enclosing scope as 'phase'.
+#define INSTRUMENT_SCOPE(phase) \
+    Instrumentation::ScopedTimer INSTRUMENT_CONCAT(instrument_timer_, __LINE__)(Instrumentation::phase)
+#define INSTRUMENT_COUNT(counter, n) Instrumentation::count(Instrumentation::counter, n)
+#define INSTRUMENT_BODY_LENGTH(length) Instrumentation::bodyLength(length)
+#else
+#define INSTRUMENT_SCOPE(phase) ((void) 0)
+#define INSTRUMENT_COUNT(counter, n) ((void) 0)
+#define INSTRUMENT_BODY_LENGTH(length) ((void) 0)
+#endif
+
+#endif //L_SYSTEMS_INSTRUMENTATION_H
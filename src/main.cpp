@@ -3,15 +3,54 @@
 #include <filesystem>
 #include "parameters.h"
 #include "model.h"
+#include "batch.h"
 
 // TODO: fixing growth logic broke the whole model, we need to make sure tree cant grow downwards
 //       rewrite in rust for fun
 //       make genes their own struct to simplify the mess with gene ids etc
 //       add a second terminal gene representing a leaf that determines how fast the plant develops (get rid of synchronous calls to 'tree.develop')
-//       add grid structure to forest and rework IO to get OBJ files of the whole forest
 
-int main() {
-    Model model(Parameters {});
-    model.run();
-    model.saveData();
+static const char *usage =
+    "Usage: L_systems [--config <file>] [<name>=<value>...] [--sweep <name>=<value>,<value>...]...\n"
+    "\n"
+    "  --config <file>   Read parameters from a file with one 'name = value' per line\n"
+    "  <name>=<value>    Set a parameter (applied in order, so later ones win)\n"
+    "  --sweep ...       Run a model for every combination of the swept values (in the same process)\n"
+    "  --parameters      Print every parameter with its value and exit\n";
+
+int main(int argc, char **argv) {
+    try {
+        Parameters parameters;
+        std::vector<Sweep> sweeps;
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                std::cout << usage;
+                return 0;
+            } else if (arg == "--parameters") {
+                parameters.write(std::cout);
+                return 0;
+            } else if ((arg == "--config" || arg == "--sweep") && i + 1 == argc) {
+                throw std::invalid_argument("Missing value after '" + arg + "'");
+            } else if (arg == "--config") {
+                parameters.readFile(argv[++i]);
+            } else if (arg == "--sweep") {
+                sweeps.push_back(Sweep::parse(argv[++i]));
+            } else {
+                parameters.set(arg);
+            }
+        }
+
+        if (!sweeps.empty())
+            return runBatch(parameters, sweeps) == 0 ? 0 : 1;
+        Model model(parameters);
+        model.run();
+        model.saveData();
+    } catch (const std::invalid_argument &e) {
+        std::cerr << "Error: " << e.what() << "\n\n" << usage;
+        return 1;
+    } catch (const std::exception &e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
 }
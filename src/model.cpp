@@ -5,9 +5,14 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <deque>
+#include <limits>
 #include "model.h"
+#include "checkpoint.h"
+#include "bounded_queue.h"
 
-Model::Model(const Parameters &parameters) :
+Model::Model(const Parameters &parameters, std::shared_ptr<ThreadPool> thread_pool) :
     parameters(parameters),
     rng(parameters.seed == 0 ? std::random_device{}() : parameters.seed),
     forest(
@@ -21,39 +26,224 @@ Model::Model(const Parameters &parameters) :
         parameters.gene_activation_length,
         rng
     ) {
-    if (!std::filesystem::create_directory(parameters.outdir)) {
+    if (parameters.islands == 0 || parameters.islands > parameters.n_pop)
+        throw std::invalid_argument("'islands' must be between 1 and 'n_pop'");
+    // Larger values would make fitness negative, which selection can't handle
+    if (!(parameters.shading >= 0. && parameters.shading <= 1.))
+        throw std::invalid_argument("'shading' must be between 0 and 1");
+    if (parameters.forest_shards < -1)
+        throw std::invalid_argument("'forest_shards' must be -1 or more");
+    if (!std::filesystem::create_directory(parameters.outdir) && !parameters.resume) {
         if (!parameters.replace_dir)
             throw std::runtime_error("Directory " + parameters.outdir + " already exists.");
         std::cerr << "WARNING: replacing files in output directory.\n";
     }
+    std::ofstream parameters_file(parameters.outdir + "/parameters.txt");
+    parameters.write(parameters_file);
+    if (parameters.log_to_file) {
+        log_file.emplace(parameters.outdir + "/log.txt", parameters.resume ? std::ios::app : std::ios::trunc);
+        if (!*log_file)
+            throw std::runtime_error("Could not open '" + parameters.outdir + "/log.txt'");
+        forest.log = &*log_file;
+    }
+
+    forest.evaluation_cache = parameters.evaluation_cache;
+    forest.thread_pool = thread_pool ? std::move(thread_pool) : std::make_shared<ThreadPool>(parameters.n_threads);
+    forest.selection = parameters.selection;
+    forest.tournament_size = parameters.tournament_size;
+    forest.competition = parameters.competition;
+    forest.shading = parameters.shading;
+    forest.tree_spacing = parameters.tree_spacing;
+    forest.shade_cell_size = parameters.shade_cell_size;
 
     // Handle optional parameters of trees and genomes
     for (auto &tree : forest.population) {
         tree.collision_precision = parameters.collision_precision;
         tree.rotation_angle = parameters.rotation_angle;
         tree.seed_skips = parameters.seed_skips;
+        tree.stream_development = parameters.stream_development;
+        tree.geometry_cache = parameters.geometry_cache;
+        tree.arena_allocation = parameters.arena_allocation;
+        tree.max_body_length = parameters.max_body_length;
+        tree.max_segments = parameters.max_segments;
+        tree.max_seconds = parameters.max_tree_seconds;
 
-        tree.genome.gene_activation_length = parameters.gene_activation_length;
         tree.genome.core_gene_substitution_chance = parameters.core_gene_substitution_chance;
     }
+
+    if (parameters.islands > 1) {
+        for (unsigned int k = 0; k < parameters.islands; k++)
+            island_rngs.emplace_back(rng());
+    }
+
+    if (Instrumentation::enabled)
+        instrumentation_log.emplace(parameters.outdir + "/instrumentation.csv", parameters.resume);
+
+    if (parameters.resume) {
+        auto path = parameters.outdir + "/checkpoint.txt";
+        auto checkpoint = Checkpoint::load(path);
+        if (checkpoint.island_rngs.size() != island_rngs.size())
+            throw std::runtime_error("Checkpoint '" + path + "' was taken with a different number of islands.");
+        checkpoint.restore(rng, island_rngs, forest);
+        generation = checkpoint.generation;
+        *forest.log << "Resuming from generation " << generation << " ('" << path << "')\n";
+    }
 }
 
 void Model::run(unsigned int generations) {
+    if (!island_rngs.empty()) {
+        runIslands(generations);
+        return;
+    }
+    if (instrumentation_log)
+        instrumentation_log->restart();
     for (unsigned int i = 0; i < generations; i++) {
-        if (i % 100 == 0) {
-            std::cout << "Generation: " << i << "\n";
+        if (parameters.stats_interval > 0 && generation % parameters.stats_interval == 0) {
+            *forest.log << "Generation: " << generation << "\n";
             forest.printStats();
-            std::cout << "\n";
+            *forest.log << "\n";
         }
 
         forest.evolve(rng);
+        generation++;
+        if (parameters.checkpoint_interval > 0 && generation % parameters.checkpoint_interval == 0)
+            checkpoint();
+        if (instrumentation_log)
+            instrumentation_log->record(generation, 1);
+    }
+    waitForCheckpoint();
+}
+
+void Model::runIslands(unsigned int generations) {
+    // Islands are only put back together when the whole forest is needed (to print stats or take a checkpoint)
+    auto next_multiple = [this](unsigned int interval) {
+        return interval > 0 ? (generation / interval + 1) * interval : std::numeric_limits<unsigned int>::max();
+    };
+    unsigned int end = generation + generations;
+    if (instrumentation_log)
+        instrumentation_log->restart();
+    while (generation < end) {
+        if (parameters.stats_interval > 0 && generation % parameters.stats_interval == 0) {
+            *forest.log << "Generation: " << generation << "\n";
+            forest.printStats();
+            *forest.log << "\n";
+        }
+
+        unsigned int stop = std::min({
+            end,
+            next_multiple(parameters.stats_interval),
+            next_multiple(parameters.checkpoint_interval)
+        });
+        unsigned int evolved = stop - generation;
+        evolveIslands(evolved);
+        generation = stop;
+        if (parameters.checkpoint_interval > 0 && generation % parameters.checkpoint_interval == 0)
+            checkpoint();
+        // Islands evolve without synchronizing, so they can only be measured together
+        if (instrumentation_log)
+            instrumentation_log->record(generation, evolved);
     }
+    waitForCheckpoint();
+}
+
+void Model::evolveIslands(unsigned int generations) {
+    size_t n_islands = island_rngs.size();
+    size_t n_trees = forest.population.size();
+    std::vector<Forest> islands(n_islands);
+    for (size_t k = 0; k < n_islands; k++) {
+        forest.copySettings(islands[k]);
+        auto begin = forest.population.begin() + (std::ptrdiff_t) (k * n_trees / n_islands);
+        auto end = forest.population.begin() + (std::ptrdiff_t) ((k + 1) * n_trees / n_islands);
+        islands[k].population.assign(std::make_move_iterator(begin), std::make_move_iterator(end));
+    }
+    forest.population.clear();
+
+    // Island 'k' receives the migrants of island 'k - 1'
+    std::deque<BoundedQueue<std::vector<Tree>>> inboxes;
+    for (size_t k = 0; k < n_islands; k++)
+        inboxes.emplace_back(1);
+
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::vector<std::thread> threads;
+    for (size_t k = 0; k < n_islands; k++) {
+        threads.emplace_back([&, k] {
+            auto &island = islands[k];
+            try {
+                for (unsigned int i = 0; i < generations; i++) {
+                    unsigned int current = generation + i;
+                    if (parameters.migration_interval > 0 && parameters.migrants > 0 && current > 0 &&
+                        current % parameters.migration_interval == 0) {
+                        if (!inboxes[(k + 1) % n_islands].push(island.fittest(parameters.migrants)))
+                            return;
+                        auto immigrants = inboxes[k].pop();
+                        if (!immigrants)
+                            return;
+                        island.replaceLeastFit(std::move(*immigrants));
+                    }
+                    island.evolve(island_rngs[k]);
+                }
+            } catch (...) {
+                {
+                    std::lock_guard lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                }
+                // Release the islands waiting for migrants from this one
+                for (auto &inbox : inboxes)
+                    inbox.close();
+            }
+        });
+    }
+    for (auto &thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+
+    forest.total_fitness = 0;
+    forest.fittest_currently.reset();
+    for (auto &island : islands) {
+        std::move(island.population.begin(), island.population.end(), std::back_inserter(forest.population));
+        if (island.fittest_ever && (!forest.fittest_ever || island.fittest_ever->fitness > forest.fittest_ever->fitness))
+            forest.fittest_ever = std::move(island.fittest_ever);
+        if (island.fittest_currently &&
+            (!forest.fittest_currently || island.fittest_currently->fitness > forest.fittest_currently->fitness))
+            forest.fittest_currently = std::move(island.fittest_currently);
+        forest.total_fitness += island.total_fitness;
+        forest.evaluation_cache_hits += island.evaluation_cache_hits;
+        forest.evaluation_cache_misses += island.evaluation_cache_misses;
+        forest.over_budget_trees += island.over_budget_trees;
+    }
+    forest.populationChanged();
+}
+
+void Model::checkpoint() {
+    waitForCheckpoint();
+    auto path = parameters.outdir + "/checkpoint.txt";
+    checkpoint_writer = std::async(std::launch::async, [snapshot = Checkpoint::take(generation, rng, island_rngs, forest), path] {
+        snapshot.save(path);
+    });
+}
+
+void Model::waitForCheckpoint() {
+    if (checkpoint_writer.valid())
+        checkpoint_writer.get();
 }
 
 void Model::saveData() {
-    forest.saveFittest(parameters.outdir);
+    if (instrumentation_log)
+        instrumentation_log->restart();
+    {
+        INSTRUMENT_SCOPE(save);
+        forest.saveFittest(parameters.outdir);
 
-    auto forestdir = parameters.outdir + "/forest";
-    std::filesystem::create_directory(forestdir);
-    forest.saveForest(forestdir);
+        auto forestdir = parameters.outdir + "/forest";
+        std::filesystem::create_directory(forestdir);
+        auto shards = parameters.forest_shards < 0 ? forest.thread_pool->size() : parameters.forest_shards;
+        forest.saveForest(forestdir, shards);
+        if (parameters.save_geometry)
+            forest.saveGeometry(forestdir + "/forest_geometry.bin");
+    }
+    if (instrumentation_log)
+        instrumentation_log->record(generation, 0);
 }
@@ -6,22 +6,65 @@
 #define L_SYSTEMS_MODEL_H
 
 #include <cmath>
+#include <future>
+#include <fstream>
 #include "parameters.h"
 #include "forest.h"
+#include "instrumentation.h"
 
 class Model {
 public:
-    explicit Model(const Parameters &parameters);
+    /*!
+     * Starts a new model, or continues the one checkpointed in 'outdir' if 'resume' is set.
+     *
+     * Models can share 'thread_pool' (one is created with 'n_threads' threads if not given).
+     */
+    explicit Model(const Parameters &parameters, std::shared_ptr<ThreadPool> thread_pool = nullptr);
 
+    //! Evolves 'generations' more generations, checkpointing every 'checkpoint_interval' generations.
     void run(unsigned int generations);
 
-    void run() { run(parameters.generations); }
+    //! Evolves until 'generations' generations in total.
+    void run() { run(parameters.generations > generation ? parameters.generations - generation : 0); }
 
     void saveData();
 
+    /*!
+     * Saves the state of the model to "checkpoint.txt" in 'outdir'.
+     *
+     * The snapshot is taken right away but written on a background thread while evolution continues.
+     */
+    void checkpoint();
+
+    //! Waits until the last checkpoint was written (rethrowing any error writing it).
+    void waitForCheckpoint();
+
     Parameters parameters;
     std::mt19937 rng;
     Forest forest;
+    //! Random number generator of every island (empty unless 'islands' > 1).
+    std::vector<std::mt19937> island_rngs;
+    //! Generations evolved so far.
+    unsigned int generation = 0;
+
+private:
+    //! Time series written to "instrumentation.csv" in 'outdir' (only if instrumentation was compiled in).
+    std::optional<InstrumentationLog> instrumentation_log;
+    //! "log.txt" in 'outdir', where the forest reports to if 'log_to_file' is set.
+    std::optional<std::ofstream> log_file;
+
+    void runIslands(unsigned int generations);
+
+    /*!
+     * Splits 'forest' into 'islands' forests, evolves each on its own thread for 'generations' generations and puts
+     * them back together.
+     *
+     * Islands are contiguous slices of the population. Every 'migration_interval' generations, each island sends
+     * copies of its 'migrants' fittest trees to the next island (in a ring), where they replace the least fit trees.
+     */
+    void evolveIslands(unsigned int generations);
+
+    std::future<void> checkpoint_writer;
 };
 
 
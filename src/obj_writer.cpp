@@ -0,0 +1,114 @@
+#include <charconv>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "obj_writer.h"
+
+static constexpr size_t buffer_size = 1 << 20;
+
+ObjWriter::ObjWriter(const std::string &path) : path(path), buffer(buffer_size) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Could not open '" + path + "': " + std::strerror(errno));
+}
+
+ObjWriter::~ObjWriter() {
+    try {
+        close();
+    } catch (const std::exception &) {}
+}
+
+void ObjWriter::close() {
+    if (fd < 0)
+        return;
+    flush();
+    int result = ::close(fd);
+    fd = -1;
+    if (result != 0)
+        throw std::runtime_error("Could not close '" + path + "': " + std::strerror(errno));
+}
+
+void ObjWriter::flush() {
+    size_t written = 0;
+    while (written < used) {
+        auto result = ::write(fd, buffer.data() + written, used - written);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            used = 0;
+            throw std::runtime_error("Could not write to '" + path + "': " + std::strerror(errno));
+        }
+        written += result;
+    }
+    used = 0;
+}
+
+void ObjWriter::put(const std::string &text) {
+    for (size_t start = 0; start < text.size(); start += max_line) {
+        reserveLine();
+        auto length = std::min(max_line, text.size() - start);
+        std::memcpy(buffer.data() + used, text.data() + start, length);
+        used += length;
+    }
+}
+
+void ObjWriter::number(double value) {
+    // Same output as 'std::to_string'
+    auto result = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), value, std::chars_format::fixed, 6);
+    used = result.ptr - buffer.data();
+}
+
+void ObjWriter::number(size_t value) {
+    auto result = std::to_chars(buffer.data() + used, buffer.data() + buffer.size(), value);
+    used = result.ptr - buffer.data();
+}
+
+void ObjWriter::vertex(const Pos &pos, const Pos &offset) {
+    reserveLine();
+    put('v');
+    put(' ');
+    number(pos.x + offset.x);
+    put(' ');
+    number(pos.y + offset.y);
+    put(' ');
+    number(pos.z + offset.z);
+    put('\n');
+    n_vertices++;
+}
+
+void ObjWriter::segments(const std::vector<std::pair<Pos, Pos>> &segments, const Pos &offset) {
+    // Index of the vertex the last segment ended at (OBJ indices start at 1)
+    size_t last = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+        const auto &[from, to] = segments[i];
+        size_t from_index;
+        if (i > 0 && from.x == segments[i - 1].second.x && from.y == segments[i - 1].second.y &&
+            from.z == segments[i - 1].second.z) {
+            from_index = last;
+        } else {
+            vertex(from, offset);
+            from_index = n_vertices;
+        }
+        vertex(to, offset);
+        last = n_vertices;
+
+        reserveLine();
+        put('l');
+        put(' ');
+        number(from_index);
+        put(' ');
+        number(last);
+        put('\n');
+    }
+}
+
+void ObjWriter::points(const std::vector<Pos> &points, const Pos &offset) {
+    for (const auto &point : points)
+        vertex(point, offset);
+}
+
+void ObjWriter::object(const std::string &name) {
+    put("o " + name + "\n");
+}
@@ -0,0 +1,77 @@
+#ifndef L_SYSTEMS_OBJ_WRITER_H
+#define L_SYSTEMS_OBJ_WRITER_H
+
+#include <string>
+#include <vector>
+#include "pos.h"
+
+/*!
+ * Writes OBJ files straight to a file descriptor through a fixed size buffer.
+ *
+ * Numbers are formatted with 'std::to_chars' in the same format as 'std::to_string', and vertex indices keep
+ * counting across calls, so several trees can be written to the same file.
+ */
+class ObjWriter {
+public:
+    explicit ObjWriter(const std::string &path);
+
+    //! Flushes and closes the file (errors are ignored, call 'close' to get them).
+    ~ObjWriter();
+
+    ObjWriter(const ObjWriter &) = delete;
+
+    ObjWriter &operator=(const ObjWriter &) = delete;
+
+    /*!
+     * Writes 'segments' displaced by 'offset' as lines.
+     *
+     * A segment starting where the previous one ended reuses its vertex instead of writing it again.
+     */
+    void segments(const std::vector<std::pair<Pos, Pos>> &segments, const Pos &offset = {0, 0, 0});
+
+    //! Writes 'points' displaced by 'offset' as lone vertices.
+    void points(const std::vector<Pos> &points, const Pos &offset = {0, 0, 0});
+
+    //! Starts a new object called 'name'.
+    void object(const std::string &name);
+
+    //! Number of vertices written so far.
+    size_t vertices() const {
+        return n_vertices;
+    }
+
+    //! Flushes and closes the file, throwing if anything couldn't be written.
+    void close();
+
+private:
+    //! Longest line written at once (a vertex with three doubles as long as they can get).
+    static constexpr size_t max_line = 1024;
+
+    void vertex(const Pos &pos, const Pos &offset);
+
+    void put(char c) {
+        buffer[used++] = c;
+    }
+
+    void put(const std::string &text);
+
+    void number(double value);
+
+    void number(size_t value);
+
+    //! Makes sure 'max_line' more bytes fit in the buffer.
+    void reserveLine() {
+        if (buffer.size() - used < max_line)
+            flush();
+    }
+
+    void flush();
+
+    int fd;
+    std::string path;
+    std::vector<char> buffer;
+    size_t used = 0;
+    size_t n_vertices = 0;
+};
+
+#endif //L_SYSTEMS_OBJ_WRITER_H
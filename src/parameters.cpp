@@ -0,0 +1,167 @@
+#include <sstream>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "parameters.h"
+
+static const std::pair<Selection, std::string> selection_names[] = {
+    {Selection::roulette, "roulette"},
+    {Selection::alias, "alias"},
+    {Selection::universal, "universal"},
+    {Selection::tournament, "tournament"}
+};
+
+template<class T>
+static void parse(const std::string &text, T &value) {
+    std::istringstream in(text);
+    T parsed;
+    in >> parsed;
+    // Unsigned values would silently wrap around
+    if (!in || !(in >> std::ws).eof() || (std::is_unsigned_v<T> && text.find('-') != std::string::npos))
+        throw std::invalid_argument("Invalid value '" + text + "'");
+    value = parsed;
+}
+
+static void parse(const std::string &text, std::string &value) {
+    value = text;
+}
+
+static void parse(const std::string &text, bool &value) {
+    if (text == "true" || text == "1")
+        value = true;
+    else if (text == "false" || text == "0")
+        value = false;
+    else
+        throw std::invalid_argument("Invalid value '" + text + "' (expected true or false)");
+}
+
+static void parse(const std::string &text, Selection &value) {
+    for (const auto &[selection, name] : selection_names) {
+        if (text == name) {
+            value = selection;
+            return;
+        }
+    }
+    throw std::invalid_argument("Invalid selection '" + text + "'");
+}
+
+template<class T>
+static std::string show(const T &value) {
+    std::ostringstream out;
+    out << std::setprecision(std::numeric_limits<double>::max_digits10) << std::boolalpha << value;
+    return out.str();
+}
+
+static std::string show(const Selection &value) {
+    for (const auto &[selection, name] : selection_names) {
+        if (value == selection)
+            return name;
+    }
+    return "unknown";
+}
+
+struct Field {
+    const char *name;
+    void (*set)(Parameters &, const std::string &);
+    std::string (*get)(const Parameters &);
+};
+
+#define FIELD(name) {#name, \
+    [](Parameters &parameters, const std::string &value) { parse(value, parameters.name); }, \
+    [](const Parameters &parameters) { return show(parameters.name); }}
+
+static const Field fields[] = {
+    FIELD(outdir),
+    FIELD(replace_dir),
+    FIELD(generations),
+    FIELD(seed),
+    FIELD(n_threads),
+    FIELD(checkpoint_interval),
+    FIELD(resume),
+    FIELD(stats_interval),
+    FIELD(log_to_file),
+    FIELD(islands),
+    FIELD(migration_interval),
+    FIELD(migrants),
+    FIELD(n_pop),
+    FIELD(evaluation_cache),
+    FIELD(selection),
+    FIELD(tournament_size),
+    FIELD(competition),
+    FIELD(shading),
+    FIELD(tree_spacing),
+    FIELD(shade_cell_size),
+    FIELD(forest_shards),
+    FIELD(save_geometry),
+    FIELD(maturity),
+    FIELD(gene_activation_length),
+    FIELD(core_gene_substitution_chance),
+    FIELD(collision_precision),
+    FIELD(rotation_angle),
+    FIELD(seed_skips),
+    FIELD(stream_development),
+    FIELD(geometry_cache),
+    FIELD(arena_allocation),
+    FIELD(max_body_length),
+    FIELD(max_segments),
+    FIELD(max_tree_seconds),
+    FIELD(start_genome_size),
+    FIELD(max_genome_size),
+    FIELD(mut_sub_rate),
+    FIELD(mut_dup_rate),
+    FIELD(mut_del_rate),
+};
+
+#undef FIELD
+
+void Parameters::set(const std::string &name, const std::string &value) {
+    for (const auto &field : fields) {
+        if (name != field.name)
+            continue;
+        try {
+            field.set(*this, value);
+        } catch (const std::invalid_argument &e) {
+            throw std::invalid_argument(std::string(e.what()) + " for parameter '" + name + "'");
+        }
+        return;
+    }
+    throw std::invalid_argument("Unknown parameter '" + name + "'");
+}
+
+void Parameters::set(const std::string &assignment) {
+    auto equals = assignment.find('=');
+    if (equals == std::string::npos)
+        throw std::invalid_argument("Expected 'name=value' but got '" + assignment + "'");
+    set(assignment.substr(0, equals), assignment.substr(equals + 1));
+}
+
+// Removes the whitespace at both ends
+static std::string trim(const std::string &text) {
+    auto begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return "";
+    return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+}
+
+void Parameters::readFile(const std::string &path) {
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Could not open config file '" + path + "'");
+    std::string line;
+    for (unsigned int line_number = 1; std::getline(file, line); line_number++) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty())
+            continue;
+        auto equals = line.find('=');
+        if (equals == std::string::npos)
+            throw std::invalid_argument(path + ":" + std::to_string(line_number) + ": expected 'name = value'");
+        set(trim(line.substr(0, equals)), trim(line.substr(equals + 1)));
+    }
+}
+
+void Parameters::write(std::ostream &out) const {
+    for (const auto &field : fields)
+        out << field.name << " = " << field.get(*this) << "\n";
+}
@@ -6,37 +6,117 @@
 #define L_SYSTEMS_PARAMETERS_H
 
 #include <cmath>
+#include <string>
+#include <ostream>
 
+enum class Selection {
+    // Fitness proportional, one independent draw per offspring (binary search over the cumulative fitness)
+    roulette,
+    // Fitness proportional, one independent draw per offspring (O(1) draws from a Walker/Vose alias table)
+    alias,
+    // Fitness proportional with evenly spaced pointers (stochastic universal sampling), so less noisy
+    universal,
+    // Fittest of 'tournament_size' trees picked uniformly
+    tournament
+};
+
+/*!
+ * Settings of a model.
+ *
+ * Every member can be set at runtime by name (see 'set'), from the command line or from a config file with one
+ * "name = value" per line.
+ */
 struct Parameters {
+    //! Sets the parameter called 'name' from its text representation (throws if the name or value are invalid).
+    void set(const std::string &name, const std::string &value);
+
+    //! Same as 'set' but from "name=value".
+    void set(const std::string &assignment);
+
+    //! Sets the parameters found in a config file ("name = value" lines, '#' starts a comment).
+    void readFile(const std::string &path);
+
+    //! Writes every parameter as a config file.
+    void write(std::ostream &out) const;
+
     // Model
     // =====
-    const std::string outdir = "out";
-    // TODO: set to false once I implement a way to read parameters from the terminal
-    const bool replace_dir = true;
-    const int generations = 500;
+    std::string outdir = "out";
+    // Write into 'outdir' even if it already exists
+    bool replace_dir = false;
+    unsigned int generations = 500;
     // Use '0' for a random seed
-    const unsigned int seed = 234347556;
+    unsigned int seed = 234347556;
+    // Threads used to evaluate the trees (results don't depend on it). Use '0' for one per core
+    unsigned int n_threads = 0;
+    // Save the state of the model to 'outdir' every this many generations (written in the background). '0' disables it
+    unsigned int checkpoint_interval = 50;
+    // Continue the model checkpointed in 'outdir' instead of starting a new one
+    bool resume = false;
+    // Print stats every this many generations. '0' disables it
+    unsigned int stats_interval = 100;
+    // Print stats and progress to "log.txt" in 'outdir' instead of the standard output (always on in batches)
+    bool log_to_file = false;
+    // Split the population into this many forests evolving on their own threads (results don't depend on 'n_threads')
+    unsigned int islands = 1;
+    // Generations between migrations: every island sends copies of its 'migrants' fittest trees to the next one
+    unsigned int migration_interval = 10;
+    unsigned int migrants = 2;
     // Forest
     // ======
-    const int n_pop = 500;
+    unsigned int n_pop = 500;
+    // Evaluate identical trees only once per generation
+    bool evaluation_cache = true;
+    Selection selection = Selection::roulette;
+    unsigned int tournament_size = 3;
+    // Trees compete for light: seeds with another tree above them are worth less
+    bool competition = false;
+    // Fraction of the value of a seed lost when it is shaded by another tree (between 0 and 1)
+    double shading = 1.0;
+    // Distance between neighbouring trees (they are planted on a square grid)
+    double tree_spacing = 10;
+    // Width of the columns used to find out which trees shade each other
+    double shade_cell_size = 1.0;
+    // Number of files the forest is saved in (written in parallel). Use '-1' for one per thread and '0' for a pair of
+    // files per tree
+    int forest_shards = -1;
+    // Also save the forest in the binary geometry format (see "geometry_file.h")
+    bool save_geometry = true;
     // Tree
     // ====
-    const int maturity = 8;
+    unsigned int maturity = 8;
     // Make sure to balance this with maturity otherwise you wont have enough memory
-    const unsigned int gene_activation_length = 2;
-    const double core_gene_substitution_chance = 0.5;
-    const unsigned int collision_precision = 1000;
-    const double rotation_angle = M_PI / 6;
+    unsigned int gene_activation_length = 2;
+    double core_gene_substitution_chance = 0.5;
+    unsigned int collision_precision = 1000;
+    double rotation_angle = M_PI / 6;
     // TODO: decide if this should be true of false (i dont think it should be a parameter but maybe).
     // True leads to faster runtimes but lower fitness (maybe also tends to look cooler?).
-    const bool seed_skips = false;
+    bool seed_skips = false;
+    // Grow trees straight from their genome instead of developing their whole body first.
+    // Produces the same trees using memory proportional to 'maturity' instead of to the size of the body, but it's
+    // slower for the short bodies trees usually evolve (see 'Tree::mature' in the benchmarks), so only worth it when
+    // bodies get too long to keep in memory
+    bool stream_development = false;
+    // Reuse the geometry of repeated motifs when streaming the development (same result). Faster for self-similar
+    // bodies, but recording the motifs costs more than it saves on the bodies trees usually evolve
+    bool geometry_cache = false;
+    // Take the temporary memory used to develop and grow trees from per-thread arenas (same result, fewer mallocs)
+    bool arena_allocation = true;
+    // Budget of every tree, '0' for no limit. Trees running over it are abandoned right away and get a fitness of 0,
+    // so a runaway genome can't exhaust the memory. Longest body (in genes) a tree can develop
+    unsigned long max_body_length = 1 << 24;
+    // Most segments a tree can grow (the segments of the whole population are kept, 48 bytes each)
+    unsigned long max_segments = 1 << 16;
+    // Seconds a tree can spend developing and growing (makes results depend on the speed of the machine)
+    double max_tree_seconds = 0;
     // Genome
     // ======
-    const unsigned int start_genome_size = 10;
-    const unsigned int max_genome_size = 100;
-    const double mut_sub_rate = 0.05;
-    const double mut_dup_rate = 0.005;
-    const double mut_del_rate = 0.005;
+    unsigned int start_genome_size = 10;
+    unsigned int max_genome_size = 100;
+    double mut_sub_rate = 0.05;
+    double mut_dup_rate = 0.005;
+    double mut_del_rate = 0.005;
 };
 
 #endif //L_SYSTEMS_PARAMETERS_H
@@ -22,6 +22,8 @@ struct Pos {
     double y = 0;
     double z = 0;
 
+    Pos(double x, double y, double z) : x(x), y(y), z(z) {}
+
     Pos(
         const CollisionPos &pos,
         unsigned int precision
@@ -32,8 +34,9 @@ struct Pos {
 
 struct DevState {
     CollisionPos pos = {};
-    double ax = 0.;
-    double ay = 0;
+    // Orientation in number of rotations (always in [0, number of rotations in a full turn))
+    int ax = 0;
+    int ay = 0;
 };
 
 struct pos_hash {
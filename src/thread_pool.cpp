@@ -0,0 +1,148 @@
+#include <algorithm>
+#include "thread_pool.h"
+
+// Pool and queue of the worker running on this thread (if any)
+static thread_local const ThreadPool *worker_pool = nullptr;
+static thread_local size_t worker_queue = 0;
+
+ThreadPool::ThreadPool(unsigned int n_threads) {
+    if (n_threads == 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < n_threads; i++)
+        queues.push_back(std::make_unique<Queue>());
+    for (unsigned int i = 0; i + 1 < n_threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(sleep_mutex);
+        stopping = true;
+    }
+    wake_up.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+size_t ThreadPool::ownQueue() const {
+    return worker_pool == this ? worker_queue : queues.size() - 1;
+}
+
+void ThreadPool::notify() {
+    std::lock_guard lock(sleep_mutex);
+    wake_up.notify_all();
+}
+
+void ThreadPool::push(Task task) {
+    auto &queue = *queues[ownQueue()];
+    {
+        std::lock_guard lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+        queued++;
+    }
+    notify();
+}
+
+bool ThreadPool::tryRunOne() {
+    size_t own = ownQueue();
+    std::optional<Task> task;
+    for (size_t k = 0; k < queues.size() && !task.has_value(); k++) {
+        auto &queue = *queues[(own + k) % queues.size()];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        // Newest task from our own queue, oldest (largest, when splitting ranges) from the others
+        if (k == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        queued--;
+    }
+    if (!task.has_value())
+        return false;
+
+    try {
+        task->func();
+    } catch (...) {
+        task->group->fail(std::current_exception());
+    }
+    if (--task->group->pending == 0)
+        notify();
+    return true;
+}
+
+void ThreadPool::work(size_t queue) {
+    worker_pool = this;
+    worker_queue = queue;
+    while (true) {
+        if (tryRunOne())
+            continue;
+        std::unique_lock lock(sleep_mutex);
+        wake_up.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping)
+            return;
+    }
+}
+
+ThreadPool::TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    } catch (...) {}
+}
+
+void ThreadPool::TaskGroup::run(std::function<void()> func) {
+    pending++;
+    pool.push({std::move(func), this});
+}
+
+void ThreadPool::TaskGroup::fail(std::exception_ptr exception) {
+    std::lock_guard lock(error_mutex);
+    if (!error)
+        error = exception;
+}
+
+void ThreadPool::TaskGroup::wait() {
+    while (pending > 0) {
+        if (pool.tryRunOne())
+            continue;
+        std::unique_lock lock(pool.sleep_mutex);
+        pool.wake_up.wait(lock, [this] { return pending == 0 || pool.queued > 0; });
+    }
+
+    std::lock_guard lock(error_mutex);
+    if (error) {
+        auto exception = error;
+        error = nullptr;
+        std::rethrow_exception(exception);
+    }
+}
+
+void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)> &func, size_t grain) {
+    grain = std::max<size_t>(grain, 1);
+    if (size() == 1 || n <= grain) {
+        for (size_t i = 0; i < n; i++)
+            func(i);
+        return;
+    }
+
+    TaskGroup group(*this);
+    std::function<void(size_t, size_t)> run_range = [&](size_t begin, size_t end) {
+        while (end - begin > grain) {
+            size_t middle = begin + (end - begin) / 2;
+            group.run([&run_range, middle, end] { run_range(middle, end); });
+            end = middle;
+        }
+        for (size_t i = begin; i < end; i++)
+            func(i);
+    };
+
+    try {
+        run_range(0, n);
+    } catch (...) {
+        group.fail(std::current_exception());
+    }
+    group.wait();
+}
@@ -0,0 +1,106 @@
+#ifndef L_SYSTEMS_THREAD_POOL_H
+#define L_SYSTEMS_THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <optional>
+
+/*!
+ * Work-stealing thread pool.
+ *
+ * Every worker has its own queue of tasks: it runs the newest task of its own queue first and, when that is empty,
+ * steals the oldest task of another queue. Tasks can spawn more tasks, and threads waiting for tasks keep running
+ * queued ones meanwhile, so loops can be nested (e.g. a tree evaluated by a parallel loop can split its own work).
+ */
+class ThreadPool {
+public:
+    //! Creates a pool where loops run on 'n_threads' threads (the caller included). Use '0' for one per core.
+    explicit ThreadPool(unsigned int n_threads);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    //! Number of threads work is split across (the caller included).
+    unsigned int size() const {
+        return workers.size() + 1;
+    }
+
+    //! Tasks that are waited for together.
+    class TaskGroup {
+    public:
+        explicit TaskGroup(ThreadPool &pool) : pool(pool) {}
+
+        //! Waits for the remaining tasks (ignoring their exceptions).
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup &) = delete;
+
+        TaskGroup &operator=(const TaskGroup &) = delete;
+
+        void run(std::function<void()> func);
+
+        //! Returns once every task of the group has finished, rethrowing the first exception thrown by them.
+        void wait();
+
+    private:
+        friend ThreadPool;
+
+        void fail(std::exception_ptr exception);
+
+        ThreadPool &pool;
+        std::atomic<size_t> pending = 0;
+        std::mutex error_mutex;
+        std::exception_ptr error;
+    };
+
+    /*!
+     * Calls 'func(i)' for every 'i' in [0, n) and returns once all calls have finished.
+     *
+     * The range is split in halves recursively until pieces have 'grain' indices, so idle threads steal large
+     * pieces first. If any call throws, the first exception is rethrown here.
+     */
+    void parallelFor(size_t n, const std::function<void(size_t)> &func, size_t grain = 1);
+
+private:
+    struct Task {
+        std::function<void()> func;
+        TaskGroup *group;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+
+    //! Runs one queued task if there is any.
+    bool tryRunOne();
+
+    //! Index of the queue the calling thread pushes to and pops from.
+    size_t ownQueue() const;
+
+    void work(size_t queue);
+
+    void notify();
+
+    // One queue per worker, the last one is shared by threads outside the pool
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued = 0;
+    std::mutex sleep_mutex;
+    std::condition_variable wake_up;
+    bool stopping = false;
+};
+
+#endif //L_SYSTEMS_THREAD_POOL_H
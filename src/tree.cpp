@@ -4,11 +4,16 @@
 
 #include <utility>
 #include <stdexcept>
-#include <unordered_set>
+#include <unordered_map>
+#include <numeric>
+#include <iomanip>
 #include "tree.h"
+#include "turtle.h"
+#include "arena.h"
+#include "instrumentation.h"
 
 Tree::Tree(
-    const std::vector<std::string> &seedling,
+    const std::vector<Gene> &seedling,
     Genome genome,
     unsigned int maturity
 ) : genome(std::move(genome)),
@@ -26,152 +31,479 @@ Tree::Tree(
     maturity
 ) {}
 
-void Tree::develop(unsigned int stage) {
-    std::vector<std::string> new_body;
+// Bodies are developed in parallel in chunks of this many genes
+static constexpr size_t develop_chunk_size = 1 << 16;
+
+// Sums the lengths of the genes in [begin, end) at row 'k' of an expansion table
+static std::uint64_t expandedLength(
+    const Gene *begin,
+    const Gene *end,
+    std::span<const std::uint64_t> lengths,
+    size_t n_genes,
+    unsigned int k
+) {
+    constexpr auto max_length = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t total = 0;
+    for (auto it = begin; it != end; it++) {
+        auto length = *it < n_genes ? lengths[k * n_genes + *it] : 1;
+        total = length > max_length - total ? max_length : total + length;
+    }
+    return total;
+}
+
+// Writes the genes activated by the genes in [begin, end) to 'out'
+static void expandGenes(const Genome &genome, const Gene *begin, const Gene *end, Gene *out) {
+    for (auto it = begin; it != end; it++) {
+        auto target_genes = genome.geneActivates(*it);
+        if (target_genes.empty()) {
+            *out++ = *it;
+            continue;
+        }
+        for (auto target_gene : target_genes) {
+            if (target_gene != Genome::no_gene)
+                *out++ = target_gene;
+        }
+    }
+}
+
+std::uint64_t Tree::bodyLengthAfter(unsigned int stage) const {
+    return expandedLength(
+        body.data(),
+        body.data() + body.size(),
+        genome.expansionLengths(stage),
+        genome.geneIdBound(),
+        stage
+    );
+}
+
+std::uint64_t Tree::longestBodyUntil(unsigned int stage) const {
+    auto lengths = genome.expansionLengths(stage);
+    size_t n_genes = genome.geneIdBound();
+    std::uint64_t longest = 0;
+    for (unsigned int k = 0; k <= stage; k++)
+        longest = std::max(longest, expandedLength(body.data(), body.data() + body.size(), lengths, n_genes, k));
+    return longest;
+}
+
+void Tree::develop(unsigned int stage, ThreadPool *thread_pool) {
+    if (stage == 0 || over_budget)
+        return;
+    INSTRUMENT_SCOPE(develop);
+    ArenaScope scope(arena_allocation);
+    // First pass: the size of every intermediate body is known from the expansion table, so the buffers
+    // are allocated once and each stage is written into a buffer of the exact size
+    auto lengths = genome.expansionLengths(stage, scope.resource());
+    size_t n_genes = genome.geneIdBound();
+    std::pmr::vector<std::uint64_t> stage_lengths(stage + 1, scope.resource());
+    for (unsigned int k = 0; k <= stage; k++)
+        stage_lengths[k] = expandedLength(body.data(), body.data() + body.size(), lengths, n_genes, k);
+    auto max_length = *std::max_element(stage_lengths.begin(), stage_lengths.end());
+    // Runaway bodies are caught here, before anything was allocated for them
+    if (max_body_length > 0 && max_length > max_body_length) {
+        abandon();
+        return;
+    }
+    if (max_length > body.max_size())
+        throw std::length_error("Body would grow to " + std::to_string(max_length) + " genes");
+
+    // Intermediate stages alternate between two scratch buffers, the last one is written straight into 'body'
+    std::pmr::vector<Gene> buffers[2] = {std::pmr::vector<Gene>(scope.resource()),
+                                         std::pmr::vector<Gene>(scope.resource())};
+    buffers[0].reserve(max_length);
+    buffers[1].reserve(stage > 1 ? max_length : 0);
+    buffers[0].assign(body.begin(), body.end());
+    auto end_by = deadline();
+    // Second pass: write each stage into the pre-sized buffer
     for (unsigned int i = 0; i < stage; i++) {
-        new_body.clear();
-
-        for (auto &gene : body) {
-            auto target_genes = genome.geneActivates(gene);
-            if (target_genes == nullptr) {
-                new_body.push_back(gene);
-                continue;
-            }
-            for (auto &target_gene : *target_genes) {
-                if (!target_gene.empty())
-                    new_body.push_back(target_gene);
-            }
+        if (end_by && std::chrono::steady_clock::now() > *end_by) {
+            abandon();
+            return;
+        }
+        const auto &current = buffers[i % 2];
+        Gene *next;
+        if (i + 1 == stage) {
+            body.resize(stage_lengths[i + 1]);
+            next = body.data();
+        } else {
+            buffers[(i + 1) % 2].resize(stage_lengths[i + 1]);
+            next = buffers[(i + 1) % 2].data();
         }
-        std::swap(body, new_body);
+
+        size_t n_chunks = (current.size() + develop_chunk_size - 1) / develop_chunk_size;
+        if (thread_pool == nullptr || n_chunks < 2) {
+            expandGenes(genome, current.data(), current.data() + current.size(), next);
+            continue;
+        }
+        // Chunks are expanded independently, each one writing where the genes before it end
+        auto chunk_begin = [&current](size_t chunk) { return current.data() + chunk * develop_chunk_size; };
+        auto chunk_end = [&current](size_t chunk) {
+            return current.data() + std::min(current.size(), (chunk + 1) * develop_chunk_size);
+        };
+        std::pmr::vector<std::uint64_t> offsets(n_chunks + 1, 0, scope.resource());
+        thread_pool->parallelFor(n_chunks, [&](size_t chunk) {
+            offsets[chunk + 1] = expandedLength(chunk_begin(chunk), chunk_end(chunk), lengths, n_genes, 1);
+        });
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        thread_pool->parallelFor(n_chunks, [&](size_t chunk) {
+            expandGenes(genome, chunk_begin(chunk), chunk_end(chunk), next + offsets[chunk]);
+        });
     }
     development_stage += stage;
+    INSTRUMENT_COUNT(genes_developed, std::accumulate(stage_lengths.begin() + 1, stage_lengths.end(), std::uint64_t(0)));
+    INSTRUMENT_BODY_LENGTH(body.size());
 }
 
-std::vector<std::string> Tree::translatedBody() const {
+template<class Body>
+static std::vector<std::string> translateGenes(const Body &genes) {
     std::vector<std::string> ret;
-    for (const auto &gene : body) {
+    for (auto gene : genes) {
         ret.push_back(Genome::translateGene(gene));
     }
     return ret;
 }
 
-unsigned int Tree::endOfBranch(std::vector<std::string>::iterator it) {
-    unsigned int nest = 0;
-    unsigned int offset = 0;
-    for (;it != body.end(); it++) {
-        if (*it == "]") {
-            if (nest == 0)
-                return offset;
-            else
-                nest--;
-        } else if (*it == "[")
-            nest++;
-        offset++;
+template<class Body>
+static std::string genesAsString(const Body &genes) {
+    std::string ret;
+    for (auto gene : genes)
+        ret += Genome::geneToString(gene);
+    return ret;
+}
+
+std::vector<std::string> Tree::translatedBody() const {
+    return translateGenes(body);
+}
+
+std::vector<std::string> Tree::translatedBody(const CompressedBody &compressed) {
+    return translateGenes(compressed);
+}
+
+std::string Tree::bodyAsString() const {
+    return genesAsString(body);
+}
+
+std::string Tree::bodyAsString(const CompressedBody &compressed) {
+    return genesAsString(compressed);
+}
+
+std::pmr::vector<size_t> Tree::branchEnds(const std::vector<Gene> &genes, std::pmr::memory_resource *resource) {
+    std::pmr::vector<size_t> ends(genes.size(), resource);
+    // Positions of the "]" after the current gene that close branches opened before it (nearest last)
+    std::pmr::vector<size_t> closes(resource);
+    for (size_t i = genes.size(); i-- > 0;) {
+        if (genes[i] == Genome::branch_close)
+            closes.push_back(i);
+        else if (genes[i] == Genome::branch_open && !closes.empty())
+            closes.pop_back();
+        ends[i] = closes.empty() ? genes.size() : closes.back();
     }
-    return offset;
+    return ends;
 }
 
 void Tree::grow() {
-    DevState cur_state = {};
-    std::vector<DevState> state_stack = {};
-    // Position -> whether a seed that counted towards fitness was inserted at that position
-    std::unordered_map<CollisionPos, bool, pos_hash> vertice_is_seed {{}};
-    segments = {};
-    auto it = body.begin();
-    while (it != body.end()) {
-        std::string &gene = *it;
-        bool inside_branch = !state_stack.empty();
-        if (gene == "[") {
-            state_stack.push_back(cur_state);
-        } else if (gene == "]") {
-            if (inside_branch) {
-                cur_state = state_stack.back();
-                state_stack.pop_back();
-            }
-        } else if (gene[0] == 'x')
-            cur_state.ax += gene[1] == '+' ? rotation_angle : -rotation_angle;
-        else if (gene[0] == 'y')
-            cur_state.ay += gene[1] == '+' ? rotation_angle : -rotation_angle;
-        else {
-            auto search = vertice_is_seed.find(cur_state.pos);
-            if (search != vertice_is_seed.end())
-                search->second = false;
-
-            double cos_ay = cos(cur_state.ay);
-            cur_state.pos.x += int(collision_precision * sin(cur_state.ax) * cos_ay);
-            cur_state.pos.y += int(collision_precision * cos(cur_state.ax) * cos_ay);
-            cur_state.pos.z += int(collision_precision * sin(cur_state.ay));
-
-            // Prevents branches growing downwards
-            // TODO: replace with excessive torque breaking branches
-            if (cur_state.pos.y < search->first.y) {
-                it = !inside_branch ? body.end() : it + endOfBranch(it);
-                continue;
-            }
-
-            vertice_is_seed.insert({cur_state.pos, gene == "*"});
-            segments.emplace_back(
-                Pos(search->first, collision_precision),
-                Pos(cur_state.pos, collision_precision)
-            );
+    if (over_budget)
+        return;
+    INSTRUMENT_SCOPE(grow);
+    ArenaScope scope(arena_allocation);
+    Turtle turtle(collision_precision, rotation_angle, seed_skips, segments, scope.resource());
+    limit(turtle);
+    // Only built once a branch has to be skipped
+    std::pmr::vector<size_t> branch_ends(scope.resource());
+    size_t i = 0;
+    while (i < body.size()) {
+        auto action = turtle.step(body[i]);
+        if (action == Turtle::stop)
+            break;
+        if (action == Turtle::skip_branch) {
+            if (branch_ends.empty())
+                branch_ends = branchEnds(body, scope.resource());
+            i = branch_ends[i];
+        } else {
+            i++;
         }
-        if (seed_skips && (gene == "*"))
-            it = !inside_branch ? body.end() : it + endOfBranch(it);
+    }
+    turtle.finish(seeds);
+    INSTRUMENT_COUNT(genes_grown, turtle.steps());
+    INSTRUMENT_COUNT(segments, segments.size());
+    if (turtle.overBudget())
+        abandon();
+}
+
+void Tree::grow(const CompressedBody &compressed) {
+    if (over_budget)
+        return;
+    INSTRUMENT_SCOPE(grow);
+    if (max_body_length > 0 && compressed.longestStage() > max_body_length) {
+        abandon();
+        return;
+    }
+    ArenaScope scope(arena_allocation);
+    Turtle turtle(collision_precision, rotation_angle, seed_skips, segments, scope.resource());
+    limit(turtle);
+    auto it = compressed.begin();
+    while (it != compressed.end()) {
+        auto action = turtle.step(*it);
+        if (action == Turtle::stop)
+            break;
+        if (action == Turtle::skip_branch)
+            it.skipBranch();
         else
-            it++;
+            ++it;
     }
+    turtle.finish(seeds);
+    INSTRUMENT_COUNT(genes_grown, turtle.steps());
+    INSTRUMENT_COUNT(segments, segments.size());
+    if (turtle.overBudget())
+        abandon();
+}
+
+CompressedBody Tree::compressedBody() const {
+    return {genome, body, maturity > development_stage ? maturity - development_stage : 0};
+}
+
+// Identifies the geometry produced by a gene expanded 'stage' times from a given orientation
+struct FragmentKey {
+    Gene gene;
+    unsigned int stage;
+    int ax;
+    int ay;
+
+    bool operator==(const FragmentKey &other) const = default;
+};
 
-    seeds = {};
-    seeds.reserve(vertice_is_seed.size());
-    for (const auto &pos : vertice_is_seed) {
-        if (pos.second)
-            seeds.emplace_back(pos.first, collision_precision);
+struct FragmentKeyHash {
+    std::size_t operator()(const FragmentKey &key) const {
+        std::size_t hash = std::hash<std::size_t>()((std::size_t(key.gene) << 32) | key.stage);
+        hashCombine(hash, key.ax);
+        hashCombine(hash, key.ay);
+        return hash;
     }
+};
+
+struct Tree::StreamContext {
+    std::pmr::vector<BranchBalance> balances;
+    size_t n_genes;
+    bool use_cache;
+    // Empty fragments mark genes whose geometry can't be reused (e.g. they got pruned)
+    std::pmr::unordered_map<FragmentKey, std::optional<Fragment>, FragmentKeyHash> fragments;
+};
+
+bool Tree::streamGene(Gene gene, unsigned int stage, Turtle &turtle, StreamContext &context) const {
+    auto target_genes = stage > 0 ? genome.geneActivates(gene) : std::span<const Gene>();
+    if (target_genes.empty())
+        return turtle.feed(gene);
+
+    const auto &balance = context.balances[stage * context.n_genes + gene];
+    if (turtle.skipping() && balance.selfContained()) {
+        turtle.skipThrough(balance.net);
+        return true;
+    }
+
+    // Self-contained genes always produce the same moves (relative to where they start) for a given orientation
+    bool record = context.use_cache && balance.selfContained() && balance.net == 0 && !turtle.skipping();
+    FragmentKey key = {gene, stage, turtle.state().ax, turtle.state().ay};
+    if (record) {
+        auto search = context.fragments.find(key);
+        if (search != context.fragments.end()) {
+            if (search->second.has_value())
+                return turtle.replay(search->second.value());
+            record = false;
+        } else {
+            turtle.startRecording();
+        }
+    }
+
+    bool keep_going = true;
+    for (auto target_gene : target_genes) {
+        if (target_gene != Genome::no_gene && !streamGene(target_gene, stage - 1, turtle, context)) {
+            keep_going = false;
+            break;
+        }
+    }
+    if (record) {
+        auto fragment = turtle.stopRecording();
+        if (keep_going)
+            context.fragments.emplace(key, std::move(fragment));
+    }
+    return keep_going;
+}
+
+void Tree::streamGrow(unsigned int stage) {
+    if (over_budget)
+        return;
+    INSTRUMENT_SCOPE(grow);
+    auto body_length = bodyLengthAfter(stage);
+    if (max_body_length > 0 && longestBodyUntil(stage) > max_body_length) {
+        abandon();
+        return;
+    }
+    ArenaScope scope(arena_allocation);
+    StreamContext context = {
+        genome.branchBalances(stage, scope.resource()),
+        genome.geneIdBound(),
+        geometry_cache,
+        std::pmr::unordered_map<FragmentKey, std::optional<Fragment>, FragmentKeyHash>(scope.resource())
+    };
+    Turtle turtle(collision_precision, rotation_angle, seed_skips, segments, scope.resource());
+    limit(turtle);
+    for (auto gene : body) {
+        if (!streamGene(gene, stage, turtle, context))
+            break;
+    }
+    turtle.finish(seeds);
+    // Length of the body the other modes would have developed, so that every mode reports the same
+    INSTRUMENT_BODY_LENGTH(body_length);
+    INSTRUMENT_COUNT(genes_grown, turtle.steps());
+    INSTRUMENT_COUNT(segments, segments.size());
+    if (turtle.overBudget())
+        abandon();
+}
+
+void Tree::mature(ThreadPool *thread_pool) {
+    // Starts a new deadline (one may be left behind by a call that threw)
+    maturing_deadline.reset();
+    maturing_deadline = deadline();
+    unsigned int remaining = maturity > development_stage ? maturity - development_stage : 0;
+    if (stream_development) {
+        streamGrow(remaining);
+    } else {
+        develop(remaining, thread_pool);
+        grow();
+    }
+    maturing_deadline.reset();
+}
+
+void Tree::abandon() {
+    over_budget = true;
+    segments.clear();
+    seeds.clear();
+}
+
+std::optional<std::chrono::steady_clock::time_point> Tree::deadline() const {
+    if (maturing_deadline)
+        return maturing_deadline;
+    if (max_seconds <= 0)
+        return {};
+    auto budget = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(max_seconds)
+    );
+    return std::chrono::steady_clock::now() + budget;
+}
+
+void Tree::limit(Turtle &turtle) const {
+    turtle.max_segments = max_segments;
+    turtle.deadline = deadline();
+}
+
+std::size_t Tree::evaluationHash() const {
+    std::size_t hash = genome.rulesHash();
+    for (auto gene : body)
+        hashCombine(hash, gene);
+    hashCombine(hash, maturity);
+    hashCombine(hash, development_stage);
+    hashCombine(hash, collision_precision);
+    hashCombine(hash, std::hash<double>()(rotation_angle));
+    hashCombine(hash, seed_skips);
+    return hash;
+}
+
+bool Tree::sameEvaluation(const Tree &other) const {
+    return genome.sameRules(other.genome) &&
+           body == other.body &&
+           maturity == other.maturity &&
+           development_stage == other.development_stage &&
+           collision_precision == other.collision_precision &&
+           rotation_angle == other.rotation_angle &&
+           seed_skips == other.seed_skips;
+}
+
+void Tree::copyGrowth(const Tree &other) {
+    body = other.body;
+    development_stage = other.development_stage;
+    segments = other.segments;
+    seeds = other.seeds;
+    over_budget = other.over_budget;
+}
+
+void Tree::save(std::ostream &out) const {
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    out << maturity << " " << development_stage << " " << collision_precision << " " << rotation_angle << " "
+        << seed_skips << " " << stream_development << " " << geometry_cache << " " << arena_allocation << " "
+        << max_body_length << " " << max_segments << " " << max_seconds << "\n";
+    writeVector(out, seedling);
+    writeVector(out, body);
+    genome.save(out);
+}
+
+Tree Tree::load(std::istream &in) {
+    unsigned int maturity, development_stage, collision_precision;
+    double rotation_angle;
+    bool seed_skips, stream_development, geometry_cache, arena_allocation;
+    std::uint64_t max_body_length, max_segments;
+    double max_seconds;
+    in >> maturity >> development_stage >> collision_precision >> rotation_angle >> seed_skips
+       >> stream_development >> geometry_cache >> arena_allocation >> max_body_length >> max_segments >> max_seconds;
+    if (!in)
+        throw std::runtime_error("Could not read tree");
+    std::vector<Gene> seedling, body;
+    readVector(in, seedling);
+    readVector(in, body);
+
+    Tree tree(seedling, Genome::load(in), maturity);
+    tree.body = std::move(body);
+    tree.development_stage = development_stage;
+    tree.collision_precision = collision_precision;
+    tree.rotation_angle = rotation_angle;
+    tree.seed_skips = seed_skips;
+    tree.stream_development = stream_development;
+    tree.geometry_cache = geometry_cache;
+    tree.arena_allocation = arena_allocation;
+    tree.max_body_length = max_body_length;
+    tree.max_segments = max_segments;
+    tree.max_seconds = max_seconds;
+    return tree;
 }
 
 Tree Tree::germinate() const {
-    return {seedling, genome, maturity};
-}
-
-std::string Tree::segmentsAsOBJ() const {
-    std::vector<std::string> vertices;
-    std::vector<std::string> lines;
-    for (const auto &[v1, v2] : segments) {
-        vertices.push_back(
-            "v " +
-            std::to_string(v1.x) + " " +
-            std::to_string(v1.y) + " " +
-            std::to_string(v1.z)
-        );
-        vertices.push_back(
-            "v " +
-            std::to_string(v2.x) + " " +
-            std::to_string(v2.y) + " " +
-            std::to_string(v2.z)
-        );
-        lines.push_back(
-            "l " +
-            std::to_string(vertices.size() - 1) + " " +
-            std::to_string(vertices.size())
-        );
-    }
-    return vecToStr(vertices, "\n") + "\n" + vecToStr(lines, "\n") + "\n";
-}
-
-std::string Tree::seedsAsOBJ() const {
-    std::vector<std::string> vertices;
-    for (const auto &seed : seeds) {
-        vertices.push_back(
-            "v " +
-            std::to_string(seed.x) + " " +
-            std::to_string(seed.y) + " " +
-            std::to_string(seed.z)
-        );
-    }
-    return vecToStr(vertices, "\n") + "\n";
+    Tree tree(seedling, genome, maturity);
+    copySettings(tree);
+    return tree;
+}
+
+void Tree::germinateInto(Tree &offspring) const {
+    offspring.genome = genome;
+    offspring.seedling = seedling;
+    offspring.body = seedling;
+    offspring.maturity = maturity;
+    offspring.development_stage = 0;
+    offspring.segments.clear();
+    offspring.seeds.clear();
+    offspring.shade = 0;
+    offspring.over_budget = false;
+    copySettings(offspring);
+}
+
+void Tree::copySettings(Tree &other) const {
+    other.collision_precision = collision_precision;
+    other.rotation_angle = rotation_angle;
+    other.seed_skips = seed_skips;
+    other.stream_development = stream_development;
+    other.geometry_cache = geometry_cache;
+    other.arena_allocation = arena_allocation;
+    other.max_body_length = max_body_length;
+    other.max_segments = max_segments;
+    other.max_seconds = max_seconds;
+}
+
+void Tree::segmentsAsOBJ(ObjWriter &obj, const Pos &offset) const {
+    obj.segments(segments, offset);
+}
+
+void Tree::seedsAsOBJ(ObjWriter &obj, const Pos &offset) const {
+    obj.points(seeds, offset);
 }
 
 // TODO: introduce other factors such as verticality, distance from base etc
 double Tree::fitness() const {
-    return (double) seeds.size();
+    return over_budget ? 0. : (double) seeds.size() - shade;
 }
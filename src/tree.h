@@ -7,48 +7,163 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
+#include <optional>
 #include "utility.h"
 #include "pos.h"
 #include "parameters.h"
 #include "genome.h"
+#include "turtle.h"
+#include "thread_pool.h"
+#include "compressed_body.h"
+#include "obj_writer.h"
 
 class Tree {
 public:
-    Tree(const std::vector<std::string> &seedling, Genome genome, unsigned int maturity);
+    Tree(const std::vector<Gene> &seedling, Genome genome, unsigned int maturity);
 
     Tree(const Genome &genome, unsigned int maturity, std::mt19937 &rng);
 
     //! Gets a clone of this tree before any growth took place.
     Tree germinate() const;
 
+    //! Same as 'germinate' but overwrites 'offspring', reusing the memory it already holds.
+    void germinateInto(Tree &offspring) const;
+
     //! Tree growth in space (updates segments and seeds).
     void grow();
 
-    //! Tree body plan development.
-    void develop(unsigned int stage);
+    /*!
+     * Position of the first "]" at or after each gene of 'genes' that closes a branch opened before it
+     * (or the size of 'genes' if there is none).
+     *
+     * Built in one backward pass, so that jumping to the end of a branch is O(1).
+     */
+    static std::pmr::vector<size_t> branchEnds(
+        const std::vector<Gene> &genes,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+    );
+
+    //! Same as 'grow' but reading the genes from 'compressed' instead of 'body' (which is left untouched).
+    void grow(const CompressedBody &compressed);
+
+    //! Body the tree will have at maturity, kept as its derivation instead of developing it.
+    CompressedBody compressedBody() const;
+
+    /*!
+     * Grows the tree as if its body had been developed 'stage' more stages, but without ever materializing it.
+     *
+     * Walks the derivation of each gene depth-first and feeds the genes straight to the turtle, so memory use
+     * is proportional to 'stage' instead of to the size of the body. The body itself is left untouched.
+     *
+     * With 'geometry_cache' set, the moves made while growing a gene whose expansion opens and closes its own
+     * branches are remembered per (gene, stage, orientation), so that repeated motifs are translated into place
+     * instead of being walked again.
+     */
+    void streamGrow(unsigned int stage);
+
+    /*!
+     * Develops the tree up to maturity and grows it (streaming the development if 'stream_development' is set).
+     *
+     * Developing and growing share the time budget ('max_seconds').
+     */
+    void mature(ThreadPool *thread_pool = nullptr);
+
+    //! Tree body plan development (large bodies are split into chunks developed in parallel if given a pool).
+    void develop(unsigned int stage, ThreadPool *thread_pool = nullptr);
+
+    //! Length the body will have after developing 'stage' more stages (saturates instead of overflowing).
+    std::uint64_t bodyLengthAfter(unsigned int stage) const;
+
+    /*!
+     * Length of the longest body among the next 'stage' stages, the current one included (saturates).
+     *
+     * This is what 'max_body_length' limits: bodies can shrink from one stage to the next once genes lost targets
+     * to deletions, so the last stage isn't always the longest.
+     */
+    std::uint64_t longestBodyUntil(unsigned int stage) const;
 
     double fitness() const;
 
+    //! Writes the tree (but not its geometry, which can be grown again) to 'out'.
+    void save(std::ostream &out) const;
+
+    //! Reads a tree written by 'save'.
+    static Tree load(std::istream &in);
+
+    //! Hash of everything that determines how the tree will develop and grow.
+    std::size_t evaluationHash() const;
+
+    //! Whether this tree would develop and grow exactly like 'other'.
+    bool sameEvaluation(const Tree &other) const;
+
+    //! Takes the developed body, segments and seeds of 'other' as if this tree had matured itself.
+    void copyGrowth(const Tree &other);
+
     std::vector<std::string> translatedBody() const;
 
-    std::string segmentsAsOBJ() const;
+    static std::vector<std::string> translatedBody(const CompressedBody &compressed);
+
+    std::string bodyAsString() const;
+
+    static std::string bodyAsString(const CompressedBody &compressed);
 
-    std::string seedsAsOBJ() const;
+    //! Writes the segments displaced by 'offset' to 'obj'.
+    void segmentsAsOBJ(ObjWriter &obj, const Pos &offset = {0, 0, 0}) const;
+
+    //! Writes the seeds displaced by 'offset' to 'obj'.
+    void seedsAsOBJ(ObjWriter &obj, const Pos &offset = {0, 0, 0}) const;
 
     Genome genome;
-    std::vector<std::string> seedling;  // Needs to be initialized by all constructors
-    std::vector<std::string> body;  // Needs to be initialized by all constructors
+    std::vector<Gene> seedling;  // Needs to be initialized by all constructors
+    std::vector<Gene> body;  // Needs to be initialized by all constructors
     unsigned int maturity;
 
     unsigned int collision_precision = 1000;
     double rotation_angle = M_PI / 6;
     bool seed_skips = false;
+    bool stream_development = false;
+    bool geometry_cache = false;
+    //! Take the temporary memory used to develop and grow from a per-thread arena instead of the global heap.
+    bool arena_allocation = true;
+    /*!
+     * Budget of the tree ('0' for no limit): longest body it can develop, most segments it can grow and seconds it
+     * can spend developing and growing. Trees are abandoned as soon as they run over it (see 'over_budget').
+     *
+     * The body length (of the longest stage, see 'longestBodyUntil') is checked before developing anything, and
+     * the same way when streaming the development or growing from a compressed body, so that the result doesn't
+     * depend on how the tree is grown. Segments and time are checked while growing.
+     */
+    std::uint64_t max_body_length = 1 << 24;
+    std::uint64_t max_segments = 1 << 16;
+    double max_seconds = 0;
     std::vector<std::pair<Pos, Pos>> segments;
     std::vector<Pos> seeds;
+    //! Fitness lost to the shade of neighbouring trees (set by the forest).
+    double shade = 0;
+    //! The tree ran over its budget while developing or growing, so it has no geometry and a fitness of 0.
+    bool over_budget = false;
 
     unsigned int development_stage = 0;
 private:
-    unsigned int endOfBranch(std::vector<std::string>::iterator it);
+    void copySettings(Tree &other) const;
+
+    //! Drops the geometry of a tree that ran over its budget.
+    void abandon();
+
+    //! Time by which developing or growing must end (shared by everything done in the 'mature' call running).
+    std::optional<std::chrono::steady_clock::time_point> deadline() const;
+
+    //! Gives 'turtle' the budget that is left for growing.
+    void limit(Turtle &turtle) const;
+
+    //! Deadline of the 'mature' call running.
+    std::optional<std::chrono::steady_clock::time_point> maturing_deadline;
+
+    struct StreamContext;
+
+    //! Returns false once the rest of the body must be ignored.
+    bool streamGene(Gene gene, unsigned int stage, Turtle &turtle, StreamContext &context) const;
 
 };
 
@@ -0,0 +1,230 @@
+#include <cmath>
+#include <map>
+#include <mutex>
+#include <memory>
+#include <stdexcept>
+#include "turtle.h"
+
+DirectionTable::DirectionTable(unsigned int collision_precision, double rotation_angle) {
+    double turns = 2 * M_PI / rotation_angle;
+    n_rotations = (int) std::lround(turns);
+    if (n_rotations < 1 || std::abs(turns - n_rotations) > 1e-6)
+        throw std::runtime_error("'rotation_angle' must divide a full turn");
+
+    steps.resize(n_rotations * n_rotations);
+    for (int ax = 0; ax < n_rotations; ax++) {
+        for (int ay = 0; ay < n_rotations; ay++) {
+            double angle_x = ax * rotation_angle;
+            double angle_y = ay * rotation_angle;
+            double cos_ay = cos(angle_y);
+            steps[ax * n_rotations + ay] = {
+                int(collision_precision * sin(angle_x) * cos_ay),
+                int(collision_precision * cos(angle_x) * cos_ay),
+                int(collision_precision * sin(angle_y))
+            };
+        }
+    }
+}
+
+// Collision maps no turtle on this thread is using
+static thread_local std::vector<std::unique_ptr<CollisionMap>> spare_maps;
+
+static std::unique_ptr<CollisionMap> borrowMap() {
+    if (spare_maps.empty())
+        return std::make_unique<CollisionMap>();
+    auto map = std::move(spare_maps.back());
+    spare_maps.pop_back();
+    map->clear();
+    return map;
+}
+
+const DirectionTable &DirectionTable::get(unsigned int collision_precision, double rotation_angle) {
+    static std::mutex mutex;
+    static std::map<std::pair<unsigned int, double>, std::unique_ptr<DirectionTable>> tables;
+
+    std::lock_guard lock(mutex);
+    auto &table = tables[{collision_precision, rotation_angle}];
+    if (!table)
+        table = std::make_unique<DirectionTable>(collision_precision, rotation_angle);
+    return *table;
+}
+
+Turtle::Turtle(
+    unsigned int collision_precision,
+    double rotation_angle,
+    bool seed_skips,
+    std::vector<std::pair<Pos, Pos>> &segments,
+    std::pmr::memory_resource *resource
+) : collision_precision(collision_precision),
+    rotation_angle(rotation_angle),
+    seed_skips(seed_skips),
+    segments(segments),
+    directions(DirectionTable::get(collision_precision, rotation_angle)),
+    resource(resource),
+    state_stack(resource),
+    vertice_is_seed(borrowMap()),
+    recordings(resource) {
+    segments.clear();
+    vertice_is_seed->insert({}, false);
+}
+
+Turtle::~Turtle() {
+    spare_maps.push_back(std::move(vertice_is_seed));
+}
+
+Turtle::Action Turtle::step(Gene gene) {
+    n_steps++;
+    if (exhausted())
+        return stop;
+    bool inside_branch = !state_stack.empty();
+    if (gene == Genome::branch_open) {
+        state_stack.push_back(cur_state);
+    } else if (gene == Genome::branch_close) {
+        if (inside_branch) {
+            cur_state = state_stack.back();
+            state_stack.pop_back();
+        }
+    } else if (gene == Genome::x_pos || gene == Genome::x_neg)
+        rotate(cur_state.ax, gene == Genome::x_pos ? 1 : -1);
+    else if (gene == Genome::y_pos || gene == Genome::y_neg)
+        rotate(cur_state.ay, gene == Genome::y_pos ? 1 : -1);
+    else {
+        const auto &step = directions.step(cur_state.ax, cur_state.ay);
+        CollisionPos to = {cur_state.pos.x + step.x, cur_state.pos.y + step.y, cur_state.pos.z + step.z};
+
+        // Prevents branches growing downwards
+        // TODO: replace with excessive torque breaking branches
+        bool pruned = to.y < cur_state.pos.y;
+        move({cur_state.pos, to, gene == Genome::seed, pruned});
+        if (pruned) {
+            escape(state_stack.size());
+            return inside_branch ? skip_branch : stop;
+        }
+    }
+    if (seed_skips && (gene == Genome::seed)) {
+        escape(state_stack.size());
+        return inside_branch ? skip_branch : stop;
+    }
+    return next;
+}
+
+void Turtle::move(const Move &move) {
+    if (auto *is_seed = vertice_is_seed->find(move.from))
+        *is_seed = false;
+    cur_state.pos = move.to;
+
+    for (auto &recording : recordings) {
+        if (!recording.valid)
+            continue;
+        if (recording.fragment.moves.size() == max_fragment_moves) {
+            recording.valid = false;
+            recording.fragment.moves.clear();
+            recording.fragment.moves.shrink_to_fit();
+            continue;
+        }
+        const auto &start = recording.start.pos;
+        recording.fragment.moves.push_back({
+            {move.from.x - start.x, move.from.y - start.y, move.from.z - start.z},
+            {move.to.x - start.x, move.to.y - start.y, move.to.z - start.z},
+            move.seed,
+            move.pruned
+        });
+    }
+
+    if (move.pruned)
+        return;
+    vertice_is_seed->insert(move.to, move.seed);
+    segments.emplace_back(
+        Pos(move.from, collision_precision),
+        Pos(move.to, collision_precision)
+    );
+}
+
+void Turtle::escape(size_t stack_depth) {
+    for (auto &recording : recordings) {
+        if (recording.stack_depth >= stack_depth)
+            recording.valid = false;
+    }
+}
+
+void Turtle::startRecording() {
+    recordings.push_back({cur_state, state_stack.size(), {std::pmr::vector<Move>(resource), {}}, true});
+}
+
+std::optional<Fragment> Turtle::stopRecording() {
+    auto recording = std::move(recordings.back());
+    recordings.pop_back();
+    if (!recording.valid)
+        return {};
+
+    const auto &start = recording.start.pos;
+    recording.fragment.end = {
+        {cur_state.pos.x - start.x, cur_state.pos.y - start.y, cur_state.pos.z - start.z},
+        cur_state.ax,
+        cur_state.ay
+    };
+    return std::move(recording.fragment);
+}
+
+bool Turtle::exhausted() {
+    n_budget_checks++;
+    if (tooManySegments() ||
+        (deadline && n_budget_checks % deadline_check_interval == 0 && std::chrono::steady_clock::now() > *deadline))
+        over_budget = true;
+    return over_budget;
+}
+
+bool Turtle::tooManySegments() const {
+    return max_segments > 0 && segments.size() > max_segments;
+}
+
+bool Turtle::replay(const Fragment &fragment) {
+    if (exhausted())
+        return false;
+    auto start = cur_state.pos;
+    for (const auto &rel_move : fragment.moves) {
+        move({
+            {start.x + rel_move.from.x, start.y + rel_move.from.y, start.z + rel_move.from.z},
+            {start.x + rel_move.to.x, start.y + rel_move.to.y, start.z + rel_move.to.z},
+            rel_move.seed,
+            rel_move.pruned
+        });
+    }
+    cur_state.pos = {start.x + fragment.end.pos.x, start.y + fragment.end.pos.y, start.z + fragment.end.pos.z};
+    cur_state.ax = fragment.end.ax;
+    cur_state.ay = fragment.end.ay;
+    // A fragment can add many segments at once
+    return !exhausted();
+}
+
+bool Turtle::feed(Gene gene) {
+    if (skip) {
+        if (gene == Genome::branch_open) {
+            skip_nest++;
+            return true;
+        }
+        if (gene != Genome::branch_close)
+            return true;
+        if (skip_nest > 0) {
+            skip_nest--;
+            return true;
+        }
+        skip = false;
+    }
+
+    auto action = step(gene);
+    if (action == skip_branch)
+        skip = true;
+    return action != stop;
+}
+
+void Turtle::finish(std::vector<Pos> &seeds_out) {
+    // The last genes or fragment may have run over the limit with nothing left to check it
+    if (tooManySegments())
+        over_budget = true;
+    seeds_out.clear();
+    vertice_is_seed->forEach([this, &seeds_out](const CollisionPos &pos, bool is_seed) {
+        if (is_seed)
+            seeds_out.emplace_back(pos, collision_precision);
+    });
+}
@@ -0,0 +1,212 @@
+#ifndef L_SYSTEMS_TURTLE_H
+#define L_SYSTEMS_TURTLE_H
+
+#include <vector>
+#include <optional>
+#include <memory>
+#include <chrono>
+#include <memory_resource>
+#include "pos.h"
+#include "collision_map.h"
+#include "genome.h"
+
+/*!
+ * Displacement of a step forward for every orientation the turtle can have.
+ *
+ * The turtle only ever rotates by multiples of 'rotation_angle', so its orientations are a finite set as long as
+ * 'rotation_angle' divides a full turn. Displacements are computed once, scaled by 'collision_precision'.
+ */
+class DirectionTable {
+public:
+    DirectionTable(unsigned int collision_precision, double rotation_angle);
+
+    //! Shared table for the given parameters (built the first time it is requested).
+    static const DirectionTable &get(unsigned int collision_precision, double rotation_angle);
+
+    const CollisionPos &step(int ax, int ay) const {
+        return steps[ax * n_rotations + ay];
+    }
+
+    //! Number of rotations in a full turn.
+    int n_rotations;
+
+private:
+    std::vector<CollisionPos> steps;
+};
+
+//! A single attempt of the turtle to move forward.
+struct Move {
+    CollisionPos from;
+    CollisionPos to;
+    bool seed;
+    //! The move went downwards and was discarded.
+    bool pruned;
+};
+
+//! Moves performed while interpreting a self-contained piece of body, relative to where the turtle started.
+struct Fragment {
+    std::pmr::vector<Move> moves;
+    //! Position relative to the start and absolute orientation of the turtle once the piece was interpreted.
+    DevState end;
+};
+
+//! Interprets a body gene by gene as movements in space, producing the segments and seeds of a tree.
+class Turtle {
+public:
+    //! What the reader of the body should do after a gene was interpreted.
+    enum Action {
+        next,  // Continue with the next gene
+        skip_branch,  // Jump to the end of the current branch (the closing "]" must still be interpreted)
+        stop  // Ignore the rest of the body
+    };
+
+    /*!
+     * Segments are appended to 'segments' as they are produced (which is cleared first).
+     *
+     * The turtle's own bookkeeping (and the fragments it records) is allocated from 'resource'.
+     */
+    Turtle(
+        unsigned int collision_precision,
+        double rotation_angle,
+        bool seed_skips,
+        std::vector<std::pair<Pos, Pos>> &segments,
+        std::pmr::memory_resource *resource = std::pmr::get_default_resource()
+    );
+
+    ~Turtle();
+
+    Turtle(const Turtle &) = delete;
+
+    Turtle &operator=(const Turtle &) = delete;
+
+    //! Interprets 'gene', leaving it to the caller to skip the genes it is told to.
+    Action step(Gene gene);
+
+    /*!
+     * Interprets 'gene', skipping branches by itself.
+     *
+     * Used when the body is produced one gene at a time and can't be jumped through.
+     * Returns false once the rest of the body must be ignored.
+     */
+    bool feed(Gene gene);
+
+    bool insideBranch() const {
+        return !state_stack.empty();
+    }
+
+    //! Whether 'feed' is currently skipping a branch.
+    bool skipping() const {
+        return skip;
+    }
+
+    /*!
+     * Skips a piece of body that never closes a branch it did not open while 'skipping()'.
+     *
+     * 'net_branches' is the number of branches the piece leaves open.
+     */
+    void skipThrough(std::int64_t net_branches) {
+        skip_nest += net_branches;
+    }
+
+    const DevState &state() const {
+        return cur_state;
+    }
+
+    //! Number of genes interpreted by 'step' so far (replayed fragments not included).
+    std::uint64_t steps() const {
+        return n_steps;
+    }
+
+    //! Whether the turtle stopped because it ran over 'max_segments' or 'deadline'.
+    bool overBudget() const {
+        return over_budget;
+    }
+
+    /*!
+     * Starts recording the moves done by the turtle until the matching 'stopRecording'.
+     *
+     * Recordings can be nested. The genes interpreted in the meantime must not close branches opened before the
+     * recording started.
+     */
+    void startRecording();
+
+    //! Returns the recorded fragment, or nothing if it escaped the piece of body it was recording or grew too large.
+    std::optional<Fragment> stopRecording();
+
+    /*!
+     * Repeats the moves of a fragment recorded from the same orientation the turtle has now.
+     *
+     * Returns false once the rest of the body must be ignored because the turtle ran over its budget (before or
+     * while replaying the fragment).
+     */
+    bool replay(const Fragment &fragment);
+
+    //! Fragments with more moves than this are not recorded.
+    static constexpr size_t max_fragment_moves = 1 << 12;
+
+    /*!
+     * Writes the seeds that count towards fitness to 'seeds' (reusing its memory).
+     *
+     * Also checks 'max_segments' a last time, so the trees that run over it are the same however they were grown.
+     */
+    void finish(std::vector<Pos> &seeds);
+
+    //! The clock is only read once every this many steps and replays.
+    static constexpr std::uint64_t deadline_check_interval = 1 << 12;
+
+    unsigned int collision_precision;
+    double rotation_angle;
+    bool seed_skips;
+    //! Stop once more than this many segments were produced ('0' for no limit), see 'overBudget'.
+    size_t max_segments = 0;
+    //! Stop once this time has passed.
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+
+private:
+    //! Rotates 'angle' by 'rotations' (-1 or 1) steps.
+    void rotate(int &angle, int rotations) const {
+        angle += rotations;
+        if (angle == directions.n_rotations)
+            angle = 0;
+        else if (angle < 0)
+            angle = directions.n_rotations - 1;
+    }
+
+    struct Recording {
+        DevState start;
+        size_t stack_depth;
+        Fragment fragment;
+        bool valid;
+    };
+
+    void move(const Move &move);
+
+    //! Whether the turtle ran over its budget (checked before every step and after every replay).
+    bool exhausted();
+
+    bool tooManySegments() const;
+
+    //! Invalidates the recordings that started at 'stack_depth' or deeper.
+    void escape(size_t stack_depth);
+
+    std::vector<std::pair<Pos, Pos>> &segments;
+    const DirectionTable &directions;
+    std::pmr::memory_resource *resource;
+    DevState cur_state = {};
+    std::pmr::vector<DevState> state_stack;
+    // Position -> whether a seed that counted towards fitness was inserted at that position
+    // (borrowed from a per-thread set of maps, so their memory is reused from tree to tree)
+    std::unique_ptr<CollisionMap> vertice_is_seed;
+
+    std::uint64_t n_steps = 0;
+    std::uint64_t n_budget_checks = 0;
+    bool over_budget = false;
+
+    // Used by 'feed' to find the end of the branch being skipped
+    bool skip = false;
+    std::int64_t skip_nest = 0;
+
+    std::pmr::vector<Recording> recordings;
+};
+
+#endif //L_SYSTEMS_TURTLE_H
@@ -6,7 +6,7 @@
 #include <sstream>
 #include "utility.h"
 
-std::uniform_real_distribution<> uniform_random(0, 1);
+thread_local std::uniform_real_distribution<> uniform_random(0, 1);
 
 double vecMean(const std::vector<double> &vec) {
     double sum = std::accumulate(vec.begin(), vec.end(), 0.0);
@@ -6,8 +6,14 @@
 #define L_SYSTEMS_UTILITY_H
 
 #include <random>
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include <istream>
+#include <ostream>
+#include <stdexcept>
 
-extern std::uniform_real_distribution<> uniform_random;
+extern thread_local std::uniform_real_distribution<> uniform_random;
 
 double vecMean(const std::vector<double> &vec);
 
@@ -15,4 +21,69 @@ double vecVariance(const std::vector<double> &vec);
 
 std::string vecToStr(const std::vector<std::string> &vec, const std::string &sep);
 
+/*!
+ * Random number engine (splitmix64) whose whole state is a single integer, so it is free to create.
+ *
+ * Used where every item needs a stream of its own, which would cost far more to set up with a 'std::mt19937'.
+ */
+class SplitMix64 {
+public:
+    using result_type = std::uint64_t;
+
+    explicit SplitMix64(std::uint64_t seed) : state(seed) {}
+
+    //! Engine for item 'i' of the streams derived from 'seed' (streams of different items don't overlap in practice).
+    static SplitMix64 stream(std::uint64_t seed, std::uint64_t i) {
+        return SplitMix64(mix(mix(seed) + i));
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        return mix(state += 0x9e3779b97f4a7c15);
+    }
+
+private:
+    static std::uint64_t mix(std::uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    std::uint64_t state;
+};
+
+//! Mixes 'value' into 'seed' (same scheme as boost::hash_combine).
+inline void hashCombine(std::size_t &seed, std::size_t value) {
+    seed ^= value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2);
+}
+
+//! Writes the size of 'vec' followed by its elements, separated by spaces.
+template<class T>
+void writeVector(std::ostream &out, const std::vector<T> &vec) {
+    out << vec.size();
+    for (const auto &value : vec)
+        out << " " << value;
+    out << "\n";
+}
+
+//! Reads a vector written by 'writeVector' into 'vec'.
+template<class T>
+void readVector(std::istream &in, std::vector<T> &vec) {
+    size_t size = 0;
+    if (!(in >> size))
+        throw std::runtime_error("Could not read the size of a vector");
+    vec.resize(size);
+    for (auto &value : vec)
+        in >> value;
+    if (!in)
+        throw std::runtime_error("Could not read the elements of a vector");
+}
+
 #endif //L_SYSTEMS_UTILITY_H
@@ -0,0 +1,128 @@
+// Grows random trees in every way the model can grow them and checks that they all end up with the same segments,
+// seeds and budget decision: developing the body (on one thread or in chunks on a pool, with and without the arena)
+// and growing it, streaming the development (with and without the geometry cache) and growing from the compressed
+// body. Genomes are mutated before growing, since deletions leave genes whose bodies shrink from stage to stage.
+//
+// Usage: growth_equivalence [n_trees]
+//
+
+#include <algorithm>
+#include <iostream>
+#include <functional>
+#include <random>
+#include <string>
+#include "../src/parameters.h"
+#include "../src/genome.h"
+#include "../src/tree.h"
+#include "../src/thread_pool.h"
+
+static constexpr unsigned int seed = 7654321;
+
+static bool samePos(const Pos &a, const Pos &b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+//! Describes the first difference between the growth of 'a' and 'b', or returns an empty string if there is none.
+static std::string difference(const Tree &a, const Tree &b) {
+    if (a.over_budget != b.over_budget)
+        return "over_budget " + std::to_string(a.over_budget) + " != " + std::to_string(b.over_budget);
+    if (a.segments.size() != b.segments.size())
+        return std::to_string(a.segments.size()) + " != " + std::to_string(b.segments.size()) + " segments";
+    for (size_t i = 0; i < a.segments.size(); i++) {
+        if (!samePos(a.segments[i].first, b.segments[i].first) || !samePos(a.segments[i].second, b.segments[i].second))
+            return "segment " + std::to_string(i) + " differs";
+    }
+    if (a.seeds.size() != b.seeds.size())
+        return std::to_string(a.seeds.size()) + " != " + std::to_string(b.seeds.size()) + " seeds";
+    for (size_t i = 0; i < a.seeds.size(); i++) {
+        if (!samePos(a.seeds[i], b.seeds[i]))
+            return "seed " + std::to_string(i) + " differs";
+    }
+    return "";
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int n_trees = argc > 1 ? std::stoul(argv[1]) : 10000;
+    Parameters parameters;
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<unsigned int> genome_size(parameters.start_genome_size, parameters.max_genome_size);
+    std::uniform_int_distribution<unsigned int> gene_activation_length(2, 4);
+    std::uniform_int_distribution<unsigned int> maturity(4, 14);
+    std::uniform_int_distribution<unsigned int> n_mutations(0, 20);
+    // Small budgets, so that plenty of trees run over them (at different points of their growth), but bodies can
+    // still get long enough to be developed in chunks
+    std::uniform_int_distribution<std::uint64_t> max_segments(0, 2000);
+    constexpr unsigned int max_tested_body_length = 1 << 20;
+    std::uniform_int_distribution<unsigned int> max_body_length_bits(4, 20);
+    std::bernoulli_distribution at_body_length(0.25);
+    std::bernoulli_distribution seed_skips(0.5);
+    // Higher than the defaults, so that genomes change a lot in a few mutations
+    constexpr double mut_rate = 0.05;
+
+    ThreadPool thread_pool(4);
+    const std::pair<std::string, std::function<void(Tree &)>> modes[] = {
+        {"threaded develop+grow", [&thread_pool](Tree &tree) {
+            tree.develop(tree.maturity, &thread_pool);
+            tree.grow();
+        }},
+        {"develop+grow without arena", [](Tree &tree) {
+            tree.arena_allocation = false;
+            tree.develop(tree.maturity);
+            tree.grow();
+        }},
+        {"stream", [](Tree &tree) {
+            tree.geometry_cache = false;
+            tree.streamGrow(tree.maturity);
+        }},
+        {"cached stream", [](Tree &tree) {
+            tree.geometry_cache = true;
+            tree.streamGrow(tree.maturity);
+        }},
+        {"stream without arena", [](Tree &tree) {
+            tree.arena_allocation = false;
+            tree.streamGrow(tree.maturity);
+        }},
+        {"compressed", [](Tree &tree) {
+            tree.grow(tree.compressedBody());
+        }},
+    };
+
+    unsigned int n_failed = 0, n_over_budget = 0, n_shrinking = 0, n_chunked = 0;
+    for (unsigned int i = 0; i < n_trees; i++) {
+        Genome genome(genome_size(rng), parameters.max_genome_size, mut_rate, mut_rate, mut_rate,
+                      gene_activation_length(rng), rng);
+        for (unsigned int k = n_mutations(rng); k > 0; k--)
+            genome.mutate(rng);
+        Tree fixture(genome, maturity(rng), rng);
+        fixture.max_segments = max_segments(rng);
+        // Budgets right at the length of the mature body catch paths that only check that length
+        auto body_length = fixture.bodyLengthAfter(fixture.maturity);
+        if (at_body_length(rng) && body_length > 0 && body_length <= max_tested_body_length)
+            fixture.max_body_length = body_length;
+        else
+            fixture.max_body_length = std::uint64_t(1) << max_body_length_bits(rng);
+        fixture.seed_skips = seed_skips(rng);
+
+        Tree expected = fixture;
+        expected.develop(expected.maturity);
+        expected.grow();
+        n_over_budget += expected.over_budget;
+        n_shrinking += fixture.longestBodyUntil(fixture.maturity) > fixture.bodyLengthAfter(fixture.maturity);
+        n_chunked += !expected.over_budget && expected.body.size() > (1 << 16);
+
+        for (const auto &[name, grow] : modes) {
+            Tree tree = fixture;
+            grow(tree);
+            auto error = difference(expected, tree);
+            if (!error.empty()) {
+                n_failed++;
+                std::cerr << "Tree " << i << " (max_segments=" << fixture.max_segments << ", max_body_length="
+                          << fixture.max_body_length << "): develop+grow and " << name << " differ: " << error
+                          << "\n";
+            }
+        }
+    }
+    std::cout << n_trees << " trees (" << n_over_budget << " over budget, " << n_shrinking << " shrinking, "
+              << n_chunked << " developed in chunks), " << n_failed << " differences\n";
+    return n_failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+// Converts a binary geometry file (as written by 'Forest::saveGeometry') to a pair of OBJ files for viewing:
+// '<output basename>_segments.obj' and '<output basename>_seeds.obj', with an object per tree.
+//
+// Usage: geometry_to_obj <geometry file> <output basename>
+//
+
+#include <iostream>
+#include "../src/geometry_file.h"
+#include "../src/obj_writer.h"
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <geometry file> <output basename>\n";
+        return 1;
+    }
+
+    try {
+        GeometryFile geometry(argv[1]);
+        std::string basename = argv[2];
+        ObjWriter segments_obj(basename + "_segments.obj");
+        ObjWriter seeds_obj(basename + "_seeds.obj");
+        std::vector<std::pair<Pos, Pos>> segments;
+        std::vector<Pos> seeds;
+        for (size_t i = 0; i < geometry.trees(); i++) {
+            auto tree = geometry.tree(i);
+            Pos origin = {0, 0, 0};
+            segments.clear();
+            for (const auto &segment : tree.segments)
+                segments.emplace_back(tree.position(segment.from), tree.position(segment.to));
+            seeds.clear();
+            for (const auto &seed : tree.seeds)
+                seeds.push_back(tree.position(seed));
+
+            segments_obj.object("tree_" + std::to_string(i));
+            segments_obj.segments(segments, origin);
+            seeds_obj.object("tree_" + std::to_string(i));
+            seeds_obj.points(seeds, origin);
+        }
+        segments_obj.close();
+        seeds_obj.close();
+        std::cout << "Converted " << geometry.trees() << " trees to '" << basename << "_*.obj'\n";
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}